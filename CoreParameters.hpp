@@ -9,11 +9,71 @@ const uint8_t  L1I_ID = 1;
 const uint8_t  L1D_ID = 2;
 const uint8_t  L2_ID = 3;
 const uint8_t  MAIN_MEM_ID = 4;
+const uint8_t  MEM_SYSTEM_ID = 5;
+const uint8_t  DIRECTORY_ID = 6;
+// Cores of the build (make CORES=n). The pipeline, L1i and L1d of core c are reached
+// with coreComponent(c, id); the other components are shared.
+#ifndef NUM_CORES
+#define NUM_CORES 1
+#endif
+const int CORE_COUNT = NUM_CORES;
+const int COMPONENT_CORE_SHIFT = 3;
+inline uint8_t coreComponent(int core, uint8_t id) { return (uint8_t)((core << COMPONENT_CORE_SHIFT) | id); }
 const uint64_t  RF_SIZE = 32;
-const uint64_t  MAIN_MEM_SIZE = 64 * 1024;
+// packed register transfer: 16 registers per request, the group in the next bit (see Pipelined.bsv)
+const uint64_t  RF_PACKED = 1 << 5;
+const uint64_t  RF_PACKED_GROUP = 1 << 4;
+const uint64_t  RF_PER_TRANSFER = 16;
+// pipeline counters: cycles, committed instructions and the instruction limit in 64-bit words 0-2,
+// the basic-block vector interval in word 3, the commit trace switch in word 4
+const uint64_t  RF_COUNTERS = 1 << 6;
+// counters of a basic-block vector (BbvBuckets in BbvCounter.bsv)
+const int BBV_BUCKETS = 64;
+// records of a commits indication (CommitBatch in CommitTrace.bsv), 4 words each
+const int COMMIT_BATCH = 4;
+const uint64_t  MAIN_MEM_SIZE = 64 * 1024; // lines, on-chip main memory
+const uint64_t  MAIN_MEM_LINE_BYTES = 64;
+// host-memory main memory (DMA_MAINMEM): default size in MB and the 26-bit line address limit
+const uint64_t  DMA_MAIN_MEM_MB = 256;
+const uint64_t  DMA_MAIN_MEM_MAX_BYTES = (1ull << 26) * MAIN_MEM_LINE_BYTES;
+// cache geometry, the same as L1LogSets/L1Ways/L2LogSets/L2Ways/L2NumBanks in MemTypes.bsv
 const int L1I_SET_COUNT_LOG2 = 6;
 const int L1I_WAY_LOG2 = 1;
 const int L1D_SET_COUNT_LOG2 = 6;
 const int L1D_WAY_LOG2 = 1;
-const int L2_SET_COUNT_LOG2 = 8;
-const int L2_WAY_LOG2 = 2;
\ No newline at end of file
+const int L2_SET_COUNT_LOG2 = 5; // per bank
+const int L2_WAY_LOG2 = 2;
+const int L2_BANK_LOG2 = 1;
+// directory entries (DIRECTORY_ID, multi-core build): tag, one sharer bit per core, state in the low 2 bits
+const int DIRECTORY_ENTRIES_LOG2 = 10;
+// Memory-system registers (MEM_SYSTEM_ID), see CacheInterface.bsv
+const uint64_t CFG_L2_ARBITER = 0;
+const uint64_t CNT_L2_REQ_INSTR = 1;
+const uint64_t CNT_L2_REQ_DATA = 2;
+const uint64_t CNT_L1I_MISS = 3;
+const uint64_t CNT_L1D_MISS = 4;
+const uint64_t CNT_L2_MISS = 5;
+const uint64_t CFG_L1I_PREFETCH = 6;
+const uint64_t CFG_L2_PREFETCH = 7;
+const uint64_t CNT_L1I_PF_ISSUED = 8;
+const uint64_t CNT_L1I_PF_USEFUL = 9;
+const uint64_t CNT_L1I_PF_LATE = 10;
+const uint64_t CNT_L2_PF_ISSUED = 11;
+const uint64_t CNT_L2_PF_USEFUL = 12;
+const uint64_t CNT_L2_PF_LATE = 13;
+const uint64_t CFG_DRAM_TCAS = 14;
+const uint64_t CFG_DRAM_TRCD = 15;
+const uint64_t CFG_DRAM_TRP = 16;
+const uint64_t CFG_DRAM_TBURST = 17;
+const uint64_t CFG_DRAM_TREFI = 18;
+const uint64_t CFG_DRAM_TRFC = 19;
+const uint64_t CFG_DRAM_QUEUE_DEPTH = 20;
+const uint64_t CNT_DRAM_ROW_HIT = 21;
+const uint64_t CNT_DRAM_ROW_EMPTY = 22;
+const uint64_t CNT_DRAM_ROW_CONFLICT = 23;
+const uint64_t CNT_DRAM_REFRESH = 24;
+const uint64_t CNT_DIR_PROBE = 25;
+const uint64_t CNT_DIR_RECALL = 26;
+// DRAM state in the main memory address space (MAIN_MEM_ID)
+const uint64_t DRAM_STATE_BASE = 1ull << 31;
+const uint64_t DRAM_BANKS = 8;
@@ -0,0 +1,176 @@
+// RV32IMC decoder shared by the host tools: funcsim (workload/funcsim) and the
+// co-simulation checker of glue.cpp. The legal instructions are the ones the
+// hardware accepts (RVUtil.bsv).
+
+#pragma once
+
+#include <stdint.h>
+
+// OP_DECODE stands for an instruction not decoded yet
+enum Op : uint8_t {
+    OP_DECODE, OP_ILLEGAL, OP_NOP,
+    OP_LUI, OP_AUIPC, OP_JAL, OP_JALR,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+    OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU, OP_SB, OP_SH, OP_SW,
+    OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI, OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI, OP_SRAI,
+    OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+    OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU,
+    OP_COUNT
+};
+
+// rd 0 is written to x[32], which nothing reads
+struct Decoded {
+    uint8_t op;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint32_t imm;
+    uint32_t length;
+};
+
+// RV32C: the 32-bit instruction a 16-bit one stands for, as expandCompressed in RVUtil.bsv.
+// Reserved encodings give 0, which is illegal.
+inline uint32_t expandCompressed(uint32_t c) {
+    auto bits = [c](int high, int low) { return (c >> low) & ((1u << (high - low + 1)) - 1); };
+    auto sext = [](uint32_t value, int width) { return (uint32_t)((int32_t)(value << (32 - width)) >> (32 - width)); };
+    auto iType = [](uint32_t imm, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode) {
+        return ((imm & 0xFFF) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode; };
+    auto rType = [](uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd) {
+        return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | 0x33; };
+    auto sType = [](uint32_t imm, uint32_t rs2, uint32_t rs1) {
+        return (((imm >> 5) & 0x7F) << 25) | (rs2 << 20) | (rs1 << 15) | (2 << 12) | ((imm & 0x1F) << 7) | 0x23; };
+    auto bType = [](uint32_t imm, uint32_t rs1, uint32_t funct3) {
+        return (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3F) << 25) | (rs1 << 15) | (funct3 << 12)
+             | (((imm >> 1) & 0xF) << 8) | (((imm >> 11) & 1) << 7) | 0x63; };
+    auto jType = [](uint32_t imm, uint32_t rd) {
+        return (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3FF) << 21) | (((imm >> 11) & 1) << 20)
+             | (((imm >> 12) & 0xFF) << 12) | (rd << 7) | 0x6F; };
+
+    uint32_t rd = bits(11, 7);
+    uint32_t rs2 = bits(6, 2);
+    uint32_t rdp = 8 + bits(4, 2);
+    uint32_t rs1p = 8 + bits(9, 7);
+    uint32_t imm6 = sext((bits(12, 12) << 5) | bits(6, 2), 6);
+    uint32_t addi4spnImm = (bits(10, 7) << 6) | (bits(12, 11) << 4) | (bits(5, 5) << 3) | (bits(6, 6) << 2);
+    uint32_t addi16spImm = sext((bits(12, 12) << 9) | (bits(4, 3) << 7) | (bits(5, 5) << 6) | (bits(2, 2) << 5) | (bits(6, 6) << 4), 10);
+    uint32_t lwImm = (bits(5, 5) << 6) | (bits(12, 10) << 3) | (bits(6, 6) << 2);
+    uint32_t lwspImm = (bits(3, 2) << 6) | (bits(12, 12) << 5) | (bits(6, 4) << 2);
+    uint32_t swspImm = (bits(8, 7) << 6) | (bits(12, 9) << 2);
+    uint32_t jImm = sext((bits(12, 12) << 11) | (bits(8, 8) << 10) | (bits(10, 9) << 8) | (bits(6, 6) << 7)
+                       | (bits(7, 7) << 6) | (bits(2, 2) << 5) | (bits(11, 11) << 4) | (bits(5, 3) << 1), 12);
+    uint32_t bImm = sext((bits(12, 12) << 8) | (bits(6, 5) << 6) | (bits(2, 2) << 5) | (bits(11, 10) << 3) | (bits(4, 3) << 1), 9);
+
+    switch ((bits(15, 13) << 2) | bits(1, 0)) {
+        case 0b00000: return addi4spnImm != 0 ? iType(addi4spnImm, 2, 0, rdp, 0x13) : 0;     // C.ADDI4SPN
+        case 0b01000: return iType(lwImm, rs1p, 2, rdp, 0x03);                                // C.LW
+        case 0b11000: return sType(lwImm, rdp, rs1p);                                         // C.SW
+        case 0b00001: return iType(imm6, rd, 0, rd, 0x13);                                    // C.ADDI, C.NOP
+        case 0b00101: return jType(jImm, 1);                                                  // C.JAL
+        case 0b01001: return iType(imm6, 0, 0, rd, 0x13);                                     // C.LI
+        case 0b01101:
+            if (rd == 2) {
+                return addi16spImm != 0 ? iType(addi16spImm, 2, 0, 2, 0x13) : 0;             // C.ADDI16SP
+            }
+            return imm6 != 0 ? ((imm6 & 0xFFFFF) << 12) | (rd << 7) | 0x37 : 0;               // C.LUI
+        case 0b10001:
+            switch (bits(11, 10)) {
+                case 0: return bits(12, 12) == 0 ? iType(rs2, rs1p, 5, rs1p, 0x13) : 0;        // C.SRLI
+                case 1: return bits(12, 12) == 0 ? iType(0x400 | rs2, rs1p, 5, rs1p, 0x13) : 0; // C.SRAI
+                case 2: return iType(imm6, rs1p, 7, rs1p, 0x13);                               // C.ANDI
+                default: {                                                                    // C.SUB, C.XOR, C.OR, C.AND
+                    static const uint32_t funct3[] = {0, 4, 6, 7};
+                    if (bits(12, 12) != 0) {
+                        return 0;
+                    }
+                    return rType(bits(6, 5) == 0 ? 0x20 : 0, rdp, rs1p, funct3[bits(6, 5)], rs1p);
+                }
+            }
+        case 0b10101: return jType(jImm, 0);                                                  // C.J
+        case 0b11001: return bType(bImm, rs1p, 0);                                            // C.BEQZ
+        case 0b11101: return bType(bImm, rs1p, 1);                                            // C.BNEZ
+        case 0b00010: return bits(12, 12) == 0 ? iType(rs2, rd, 1, rd, 0x13) : 0;             // C.SLLI
+        case 0b01010: return rd != 0 ? iType(lwspImm, 2, 2, rd, 0x03) : 0;                    // C.LWSP
+        case 0b10010:
+            if (bits(12, 12) == 0) {
+                if (rs2 != 0) return rType(0, rs2, 0, 0, rd);                                  // C.MV
+                return rd != 0 ? iType(0, rd, 0, 0, 0x67) : 0;                                 // C.JR
+            }
+            if (rs2 != 0) return rType(0, rs2, rd, 0, rd);                                     // C.ADD
+            if (rd != 0) return iType(0, rd, 0, 1, 0x67);                                      // C.JALR
+            return iType(1, 0, 0, 0, 0x73);                                                    // C.EBREAK
+        case 0b11010: return sType(swspImm, rs2, 2);                                          // C.SWSP
+        default: return 0;
+    }
+}
+
+// the legal instructions are the ones of isLegalInstruction in RVUtil.bsv
+inline Decoded decode(uint32_t inst, uint32_t length) {
+    Decoded d;
+    uint32_t opcode = inst & 0x7F;
+    uint32_t rd = (inst >> 7) & 0x1F;
+    uint32_t funct3 = (inst >> 12) & 0x7;
+    uint32_t funct7 = inst >> 25;
+    d.rd = rd == 0 ? 32 : rd;
+    d.rs1 = (inst >> 15) & 0x1F;
+    d.rs2 = (inst >> 20) & 0x1F;
+    d.length = length;
+    d.op = OP_ILLEGAL;
+    uint32_t immI = (int32_t)inst >> 20;
+    uint32_t immS = ((int32_t)inst >> 25 << 5) | ((inst >> 7) & 0x1F);
+    uint32_t immB = ((int32_t)inst >> 31 << 12) | (((inst >> 7) & 1) << 11) | (((inst >> 25) & 0x3F) << 5) | (((inst >> 8) & 0xF) << 1);
+    uint32_t immJ = ((int32_t)inst >> 31 << 20) | (inst & 0xFF000) | (((inst >> 20) & 1) << 11) | (((inst >> 21) & 0x3FF) << 1);
+    d.imm = immI;
+
+    switch (opcode) {
+        case 0x37: d.op = OP_LUI; d.imm = inst & 0xFFFFF000; break;
+        case 0x17: d.op = OP_AUIPC; d.imm = inst & 0xFFFFF000; break;
+        case 0x6F: d.op = OP_JAL; d.imm = immJ; break;
+        case 0x67: if (funct3 == 0) d.op = OP_JALR; break;
+        case 0x63: {
+            static const uint8_t ops[] = {OP_BEQ, OP_BNE, OP_ILLEGAL, OP_ILLEGAL, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU};
+            d.op = ops[funct3];
+            d.imm = immB;
+            break;
+        }
+        case 0x03: {
+            static const uint8_t ops[] = {OP_LB, OP_LH, OP_LW, OP_ILLEGAL, OP_LBU, OP_LHU, OP_ILLEGAL, OP_ILLEGAL};
+            d.op = ops[funct3];
+            break;
+        }
+        case 0x23: {
+            static const uint8_t ops[] = {OP_SB, OP_SH, OP_SW, OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL};
+            d.op = ops[funct3];
+            d.imm = immS;
+            break;
+        }
+        case 0x13: {
+            static const uint8_t ops[] = {OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_ORI, OP_ANDI};
+            d.op = ops[funct3];
+            if (funct3 == 1 && funct7 != 0) d.op = OP_ILLEGAL;
+            if (funct3 == 5 && funct7 == 0x20) d.op = OP_SRAI;
+            else if (funct3 == 5 && funct7 != 0) d.op = OP_ILLEGAL;
+            if (funct3 == 1 || funct3 == 5) d.imm &= 0x1F;
+            break;
+        }
+        case 0x33:
+            if (funct7 == 1) {
+                static const uint8_t ops[] = {OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU};
+                d.op = ops[funct3];
+            } else if (funct7 == 0) {
+                static const uint8_t ops[] = {OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND};
+                d.op = ops[funct3];
+            } else if (funct7 == 0x20 && funct3 == 0) {
+                d.op = OP_SUB;
+            } else if (funct7 == 0x20 && funct3 == 5) {
+                d.op = OP_SRA;
+            }
+            break;
+        // ECALL, EBREAK, MRET and WFI do nothing in the hardware
+        case 0x73:
+            if (funct3 == 0 && rd == 0 && d.rs1 == 0 && (inst >> 20 == 0 || inst >> 20 == 1 || inst >> 20 == 0x302 || inst >> 20 == 0x105)) {
+                d.op = OP_NOP;
+            }
+            break;
+    }
+    return d;
+}
@@ -1,17 +1,29 @@
 #include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <atomic>
 #include <semaphore.h>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <thread>
 
 #include "json.hpp"
 #include "CoreParameters.hpp"
+#include "RVDecode.hpp"
 #include "CoreRequest.h"
 #include "CoreIndication.h"
 #include "GeneratedTypes.h"
+#ifdef DMA_MAINMEM
+#include "dmaManager.h"
+#endif
 
 
 #define POS_MOD(a, b) ((a) % (b) + (b)) % (b)
@@ -21,10 +33,201 @@ using json = nlohmann::json;
 std::atomic_uint64_t wait_for_hardware = {0};
 std::atomic_uint64_t halt_flag = {0};
 std::atomic_uint64_t quit_flag = {0};
+std::atomic_uint64_t window_flag = {0};
 
 static CoreRequestProxy *coreRequestProxy = 0;
 
 static uint64_t receivedData[8] = {0};
+static uint32_t quiesceCycles = 0;
+
+// Fork snapshot: the old memory image, written to forkPath while the core runs. With
+// the BRAM it arrives line by line from the hardware, with host memory it is a copy
+// of the buffer.
+static std::vector<uint64_t> forkImage;
+static std::string forkPath;
+static std::atomic_bool forkActive = {false};
+
+static void writeForkImage() {
+    FILE *memFile = fopen(forkPath.c_str(), "wb");
+    if (memFile == NULL || fwrite(forkImage.data(), MAIN_MEM_LINE_BYTES, forkImage.size() / 8, memFile) != forkImage.size() / 8) {
+        fprintf(stderr, "Cannot write %s\n", forkPath.c_str());
+    } else {
+        printf("Fork snapshot memory written to %s\n", forkPath.c_str());
+    }
+    if (memFile != NULL) {
+        fclose(memFile);
+    }
+    forkActive.store(false);
+}
+
+// basic-block vectors: the counters of the interval being received, per core, and the
+// files the finished intervals go to
+static std::mutex bbvLock;
+static std::vector<std::vector<uint32_t>> bbvVectors(CORE_COUNT, std::vector<uint32_t>(BBV_BUCKETS));
+static std::vector<FILE *> bbvFiles(CORE_COUNT);
+static std::vector<FILE *> bbvLengthFiles(CORE_COUNT);
+
+// Co-simulation: a golden model of every core follows the instructions the hardware
+// commits (CommitTrace.bsv) in the order they arrive, from the state taken by
+// startCosim. The loads of a multi-core build and the MMIO loads take the value of the
+// hardware, the golden model cannot order them against the other cores and the devices.
+struct GoldenHart {
+    uint32_t pc = 0;
+    uint32_t x[33] = {0};
+    uint64_t checked = 0;
+};
+static std::mutex cosimLock;
+static bool cosimActive = false;
+static bool cosimDiverged = false;
+static std::vector<GoldenHart> cosimHarts(CORE_COUNT);
+static std::vector<uint8_t> cosimMemory;
+
+// isMMIO in Pipelined.bsv, on the aligned address
+static bool isMMIOAddress(uint32_t addr) {
+    return addr == 0xF000FFF0 || addr == 0xF000FFF4 || addr == 0xF000FFF8 || addr == 0xF000FFFC || addr == 0xF000FFEC || addr == 0xF000FFE8;
+}
+
+// One committed instruction (pc, instruction, value, address) against the golden model
+// of the core, which then executes it. Returns false with the difference in why.
+static bool checkCommit(int core, const uint32_t record[4], std::string &why) {
+    GoldenHart &hart = cosimHarts[core];
+    uint32_t *x = hart.x;
+    // the memory wraps at its size like the hardware
+    auto byte = [](uint32_t addr) -> uint8_t & { return cosimMemory[addr % cosimMemory.size()]; };
+    auto differs = [&why](const std::string &field, uint32_t hardware, uint32_t expected) {
+        char text[96];
+        snprintf(text, sizeof(text), " 0x%08x, expected 0x%08x", hardware, expected);
+        why = field + text;
+        return false;
+    };
+
+    if (record[0] != hart.pc) {
+        return differs("pc", record[0], hart.pc);
+    }
+    uint32_t inst = byte(hart.pc) | (byte(hart.pc + 1) << 8);
+    uint32_t length = 2;
+    if ((inst & 3) != 3) {
+        inst = expandCompressed(inst);
+    } else {
+        inst |= (byte(hart.pc + 2) << 16) | (byte(hart.pc + 3) << 24);
+        length = 4;
+    }
+    if (record[1] != inst) {
+        return differs("instruction", record[1], inst);
+    }
+
+    Decoded d = decode(inst, length);
+    uint32_t rs1 = x[d.rs1];
+    uint32_t rs2 = x[d.rs2];
+    uint32_t next = hart.pc + length;
+    // loads and stores use the aligned word, with the data shifted by the offset in it
+    uint32_t addr = rs1 + d.imm;
+    uint32_t aligned = addr & ~3u;
+    uint32_t shift = (addr & 3) * 8;
+    uint32_t loaded = 0;
+    if (d.op >= OP_LB && d.op <= OP_SW) {
+        if (record[3] != addr) {
+            return differs("address", record[3], addr);
+        }
+        if (isMMIOAddress(aligned) || CORE_COUNT > 1) {
+            loaded = record[2];
+        } else {
+            loaded = byte(aligned) | (byte(aligned + 1) << 8) | (byte(aligned + 2) << 16) | ((uint32_t)byte(aligned + 3) << 24);
+            loaded >>= shift;
+        }
+    }
+
+    bool writesRd = true;
+    uint32_t result = 0;
+    auto branch = [&](bool taken) {
+        writesRd = false;
+        if (taken) {
+            next = hart.pc + d.imm;
+        }
+    };
+    auto store = [&](uint32_t bytes) {
+        writesRd = false;
+        uint32_t data = rs2 << shift;
+        if (record[2] != data) {
+            return differs("store data", record[2], data);
+        }
+        if (!isMMIOAddress(aligned)) {
+            for (uint32_t b = addr & 3; b < 4 && b < (addr & 3) + bytes; ++b) {
+                byte(aligned + b) = data >> (b * 8);
+            }
+        }
+        return true;
+    };
+
+    switch (d.op) {
+        // the hardware redirects the fetch to 0
+        case OP_ILLEGAL: writesRd = false; next = 0; break;
+        case OP_NOP: writesRd = false; break;
+        case OP_LUI: result = d.imm; break;
+        case OP_AUIPC: result = hart.pc + d.imm; break;
+        case OP_JAL: result = next; next = hart.pc + d.imm; break;
+        case OP_JALR: result = next; next = (rs1 + d.imm) & ~1u; break;
+        case OP_BEQ: branch(rs1 == rs2); break;
+        case OP_BNE: branch(rs1 != rs2); break;
+        case OP_BLT: branch((int32_t)rs1 < (int32_t)rs2); break;
+        case OP_BGE: branch((int32_t)rs1 >= (int32_t)rs2); break;
+        case OP_BLTU: branch(rs1 < rs2); break;
+        case OP_BGEU: branch(rs1 >= rs2); break;
+        case OP_LB: result = (int32_t)(int8_t)loaded; break;
+        case OP_LH: result = (int32_t)(int16_t)loaded; break;
+        case OP_LW: result = loaded; break;
+        case OP_LBU: result = (uint8_t)loaded; break;
+        case OP_LHU: result = (uint16_t)loaded; break;
+        case OP_SB: if (!store(1)) return false; break;
+        case OP_SH: if (!store(2)) return false; break;
+        case OP_SW: if (!store(4)) return false; break;
+        case OP_ADDI: result = rs1 + d.imm; break;
+        case OP_SLTI: result = (int32_t)rs1 < (int32_t)d.imm; break;
+        case OP_SLTIU: result = rs1 < d.imm; break;
+        case OP_XORI: result = rs1 ^ d.imm; break;
+        case OP_ORI: result = rs1 | d.imm; break;
+        case OP_ANDI: result = rs1 & d.imm; break;
+        case OP_SLLI: result = rs1 << d.imm; break;
+        case OP_SRLI: result = rs1 >> d.imm; break;
+        case OP_SRAI: result = (int32_t)rs1 >> d.imm; break;
+        case OP_ADD: result = rs1 + rs2; break;
+        case OP_SUB: result = rs1 - rs2; break;
+        case OP_SLL: result = rs1 << (rs2 & 31); break;
+        case OP_SLT: result = (int32_t)rs1 < (int32_t)rs2; break;
+        case OP_SLTU: result = rs1 < rs2; break;
+        case OP_XOR: result = rs1 ^ rs2; break;
+        case OP_SRL: result = rs1 >> (rs2 & 31); break;
+        case OP_SRA: result = (int32_t)rs1 >> (rs2 & 31); break;
+        case OP_OR: result = rs1 | rs2; break;
+        case OP_AND: result = rs1 & rs2; break;
+        case OP_MUL: result = rs1 * rs2; break;
+        case OP_MULH: result = ((int64_t)(int32_t)rs1 * (int64_t)(int32_t)rs2) >> 32; break;
+        case OP_MULHSU: result = ((int64_t)(int32_t)rs1 * (int64_t)(uint64_t)rs2) >> 32; break;
+        case OP_MULHU: result = ((uint64_t)rs1 * (uint64_t)rs2) >> 32; break;
+        case OP_DIV:
+            if (rs2 == 0) result = ~0u;
+            else if (rs1 == 0x80000000 && rs2 == ~0u) result = rs1;
+            else result = (int32_t)rs1 / (int32_t)rs2;
+            break;
+        case OP_DIVU: result = rs2 == 0 ? ~0u : rs1 / rs2; break;
+        case OP_REM:
+            if (rs2 == 0) result = rs1;
+            else if (rs1 == 0x80000000 && rs2 == ~0u) result = 0;
+            else result = (int32_t)rs1 % (int32_t)rs2;
+            break;
+        case OP_REMU: result = rs2 == 0 ? rs1 : rs1 % rs2; break;
+    }
+
+    if (writesRd && d.rd != 32) {
+        if (record[2] != result) {
+            return differs("x" + std::to_string(d.rd), record[2], result);
+        }
+        x[d.rd] = result;
+    }
+    hart.pc = next;
+    hart.checked++;
+    return true;
+}
 
 class Buffer {
 public:
@@ -74,15 +277,41 @@ public:
         assert(wait_for_hardware.load() == 1);
         wait_for_hardware.fetch_sub(1);
     }
-    virtual void canonicalized() override {
+    virtual void canonicalized(const uint32_t cycles) override {
+        quiesceCycles = cycles;
+        assert(wait_for_hardware.load() == 1);
+        wait_for_hardware.fetch_sub(1);
+    }
+    virtual void flushed() override {
+        assert(wait_for_hardware.load() == 1);
+        wait_for_hardware.fetch_sub(1);
+    }
+    virtual void cachesInvalidated() override {
+        assert(wait_for_hardware.load() == 1);
+        wait_for_hardware.fetch_sub(1);
+    }
+    virtual void snapshotStreamed() override {
         assert(wait_for_hardware.load() == 1);
         wait_for_hardware.fetch_sub(1);
-
     }
     virtual void restarted() override {
         assert(wait_for_hardware.load() == 1);
         wait_for_hardware.fetch_sub(1);
     }
+    // comes on its own while the host waits in runInstructions
+    virtual void windowDone() override {
+        window_flag.fetch_add(1);
+    }
+
+    virtual void forkLine(const uint32_t line, const bsvvector_Luint32_t_L16 data) override {
+        uint64_t *words = &forkImage[(uint64_t)line * 8];
+        for (int index = 0; index < 8; ++index) {
+            words[8 - index - 1] = (uint64_t(data[2*index]) << 32) | uint64_t(data[2*index + 1]);
+        }
+    }
+    virtual void forked() override {
+        writeForkImage();
+    }
 
     virtual void response(const bsvvector_Luint32_t_L16 output) override {
         for (int index = 0; index < 8; ++index) {
@@ -93,6 +322,52 @@ public:
         wait_for_hardware.fetch_sub(1);
     }
 
+    virtual void bbvCounts(const uint8_t core, const uint8_t group, const bsvvector_Luint32_t_L16 counts) override {
+        std::lock_guard<std::mutex> guard(bbvLock);
+        for (int index = 0; index < 16; ++index) {
+            bbvVectors[core][group * 16 + index] = counts[16 - index - 1];
+        }
+    }
+    // one line per interval in the SimPoint frequency vector format, T:<bucket>:<count> ...
+    // with the buckets numbered from 1, and the length of the interval in the .len file
+    virtual void bbvEnd(const uint8_t core, const uint32_t instructions) override {
+        std::lock_guard<std::mutex> guard(bbvLock);
+        if (bbvFiles[core] == NULL) {
+            return;
+        }
+        fprintf(bbvFiles[core], "T");
+        for (int bucket = 0; bucket < BBV_BUCKETS; ++bucket) {
+            if (bbvVectors[core][bucket] != 0) {
+                fprintf(bbvFiles[core], ":%d:%u ", bucket + 1, bbvVectors[core][bucket]);
+            }
+        }
+        fprintf(bbvFiles[core], "\n");
+        fprintf(bbvLengthFiles[core], "%u\n", instructions);
+    }
+
+    virtual void commits(const uint8_t core, const uint8_t count, const bsvvector_Luint32_t_L16 records) override {
+        std::lock_guard<std::mutex> guard(cosimLock);
+        if (!cosimActive || cosimDiverged) {
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            uint32_t record[4];
+            for (int field = 0; field < 4; ++field) {
+                record[field] = records[16 - (4 * i + field) - 1];
+            }
+            std::string why;
+            if (!checkCommit(core, record, why)) {
+                fprintf(stderr, "\ncosim: core %d diverges after %lu instructions, at pc 0x%08x (0x%08x): %s\n",
+                        core, cosimHarts[core].checked, record[0], record[1], why.c_str());
+                cosimDiverged = true;
+                // ends the window like an instruction limit; the main thread may be
+                // waiting on the hardware, so no blocking helper here
+                coreRequestProxy->stopCores();
+                return;
+            }
+        }
+    }
+
     virtual void requestMMIO(const uint64_t data) override {
         if((data >> 32) & 0x1) {
             fprintf(stderr, "%d", static_cast<int>(data & 0xFFFFFFFF));
@@ -147,11 +422,35 @@ static void halt() {
     while(wait_for_hardware.load() != 0);
 }
 
-static void canonicalize() {
+// squash drops the instructions not yet executed instead of draining the pipeline
+static void canonicalize(bool squash) {
+    assert(wait_for_hardware.load() == 0);
+    wait_for_hardware.fetch_add(1);
+
+    coreRequestProxy->canonicalize(squash);
+
+    while(wait_for_hardware.load() != 0);
+
+    printf("Canonicalized in %u cycles\n", quiesceCycles);
+}
+
+// Writes the dirty cache lines back to main memory, after canonicalize. With
+// invalidate the caches are empty afterwards.
+static void flushCaches(bool invalidate) {
+    assert(wait_for_hardware.load() == 0);
+    wait_for_hardware.fetch_add(1);
+
+    coreRequestProxy->flush(invalidate);
+
+    while(wait_for_hardware.load() != 0);
+}
+
+// Drops every cache line without writing it back, after canonicalize.
+static void invalidateCaches() {
     assert(wait_for_hardware.load() == 0);
     wait_for_hardware.fetch_add(1);
 
-    coreRequestProxy->canonicalize();
+    coreRequestProxy->invalidateCaches();
 
     while(wait_for_hardware.load() != 0);
 }
@@ -181,32 +480,299 @@ static void request(bool readOrWrite, uint8_t id, const uint64_t addr, const uin
     while(wait_for_hardware.load() != 0);
 }
 
-static json extractSpecificCache(uint8_t id, int log2SetCount, int log2WayCount) {
+static uint64_t readMemSystem(uint64_t addr) {
+    uint64_t fake_buffer[8] = {0};
+    request(READ, MEM_SYSTEM_ID, addr, fake_buffer);
+    return receivedData[0];
+}
+
+static void writeMemSystem(uint64_t addr, uint64_t value) {
+    uint64_t write_buffer[8] = {0};
+    write_buffer[0] = value;
+    request(WRITE, MEM_SYSTEM_ID, addr, write_buffer);
+}
+
+#ifdef DMA_MAINMEM
+static DmaManager *dmaManager = 0;
+
+// Snapshot state moved by the hardware stream (see F2H.bsv): one 64-byte slot per
+// state request of the host walk. While stateStream is set, readState and writeState
+// use the buffer instead of requests.
+static int streamFd = -1;
+static uint64_t *streamBuffer = 0;
+static uint32_t streamRef = 0;
+static bool stateStream = false;
+
+// slot of a state request in the stream, in the order of the hardware walk: the
+// registers and L1s of each core, then the L2, the DRAM state and the directory
+static uint64_t streamSlot(uint8_t id, uint64_t addr) {
+    const int geometry[3][3] = {
+        {L1I_SET_COUNT_LOG2, L1I_WAY_LOG2, 0},
+        {L1D_SET_COUNT_LOG2, L1D_WAY_LOG2, 0},
+        {L2_SET_COUNT_LOG2, L2_WAY_LOG2, L2_BANK_LOG2},
+    };
+    // slots of cache c, and the slot of addr within it
+    auto cacheSlots = [&](int c) {
+        return ((uint64_t)1 << (geometry[c][0] + geometry[c][2])) * (1 + (1 << geometry[c][1]));
+    };
+    auto cacheSlot = [&](int c) {
+        int log2SetCount = geometry[c][0];
+        int log2WayCount = geometry[c][1];
+        uint64_t set = (addr >> 2) & ((1 << log2SetCount) - 1);
+        uint64_t way = (addr >> (2 + log2SetCount)) & ((1 << log2WayCount) - 1);
+        uint64_t bank = addr >> (2 + log2SetCount + log2WayCount);
+        uint64_t sub = (addr & 0x3) == 0x3 ? 0 : 1 + way;
+        return ((bank << log2SetCount) + set) * (1 + (1 << log2WayCount)) + sub;
+    };
+
+    int core = id >> COMPONENT_CORE_SHIFT;
+    uint8_t kind = id & ((1 << COMPONENT_CORE_SHIFT) - 1);
+    uint64_t coreSlots = RF_SIZE / RF_PER_TRANSFER + cacheSlots(0) + cacheSlots(1);
+    uint64_t slot = core * coreSlots;
+    if (kind == REGISTER_FILE_ID) {
+        return slot + ((addr & RF_PACKED_GROUP) ? 1 : 0);
+    }
+    slot += RF_SIZE / RF_PER_TRANSFER;
+    if (kind == L1I_ID) {
+        return slot + cacheSlot(0);
+    }
+    slot += cacheSlots(0);
+    if (kind == L1D_ID) {
+        return slot + cacheSlot(1);
+    }
+
+    slot = CORE_COUNT * coreSlots;
+    if (kind == L2_ID) {
+        return slot + cacheSlot(2);
+    }
+    slot += cacheSlots(2);
+    if (kind == MAIN_MEM_ID) {
+        return slot + (addr & ~DRAM_STATE_BASE);
+    }
+    slot += DRAM_BANKS + 1;
+
+    // directory entry
+    return slot + addr;
+}
+
+static uint64_t streamBytes() {
+    if (CORE_COUNT > 1) {
+        return (streamSlot(DIRECTORY_ID, (1 << DIRECTORY_ENTRIES_LOG2) - 1) + 1) * 64;
+    }
+    return (streamSlot(MAIN_MEM_ID, DRAM_STATE_BASE | DRAM_BANKS) + 1) * 64;
+}
+
+static void initStreamBuffer() {
+    streamFd = portalAlloc(streamBytes(), 0);
+    streamBuffer = (uint64_t *)portalMmap(streamFd, streamBytes());
+    streamRef = dmaManager->reference(streamFd);
+}
+
+// restore = false dumps the state into the buffer, true loads it from the buffer
+static void streamSnapshot(bool restore) {
+    assert(wait_for_hardware.load() == 0);
+    wait_for_hardware.fetch_add(1);
+
+    portalCacheFlush(streamFd, streamBuffer, streamBytes(), 1);
+    coreRequestProxy->streamSnapshot(restore, streamRef);
+
+    while(wait_for_hardware.load() != 0);
+
+    portalCacheFlush(streamFd, streamBuffer, streamBytes(), 1);
+}
+#endif
+
+// One 512-bit state word of a component, from the hardware or from the stream buffer.
+static const uint64_t *readState(uint8_t id, uint64_t addr) {
+#ifdef DMA_MAINMEM
+    if (stateStream) {
+        return streamBuffer + 8 * streamSlot(id, addr);
+    }
+#endif
+    uint64_t fake_buffer[8] = {0};
+    request(READ, id, addr, fake_buffer);
+    return receivedData;
+}
+
+static void writeState(uint8_t id, uint64_t addr, const uint64_t data[8]) {
+#ifdef DMA_MAINMEM
+    if (stateStream) {
+        memcpy(streamBuffer + 8 * streamSlot(id, addr), data, 64);
+        return;
+    }
+#endif
+    request(WRITE, id, addr, data);
+}
+
+static const std::pair<const char *, uint64_t> memCounters[] = {
+    {"l2_req_instr", CNT_L2_REQ_INSTR},
+    {"l2_req_data", CNT_L2_REQ_DATA},
+    {"l1i_miss", CNT_L1I_MISS},
+    {"l1d_miss", CNT_L1D_MISS},
+    {"l2_miss", CNT_L2_MISS},
+    {"l1i_pf_issued", CNT_L1I_PF_ISSUED},
+    {"l1i_pf_useful", CNT_L1I_PF_USEFUL},
+    {"l1i_pf_late", CNT_L1I_PF_LATE},
+    {"l2_pf_issued", CNT_L2_PF_ISSUED},
+    {"l2_pf_useful", CNT_L2_PF_USEFUL},
+    {"l2_pf_late", CNT_L2_PF_LATE},
+    {"dram_row_hit", CNT_DRAM_ROW_HIT},
+    {"dram_row_empty", CNT_DRAM_ROW_EMPTY},
+    {"dram_row_conflict", CNT_DRAM_ROW_CONFLICT},
+    {"dram_refresh", CNT_DRAM_REFRESH},
+    {"dir_probe", CNT_DIR_PROBE},
+    {"dir_recall", CNT_DIR_RECALL},
+};
+
+struct CoreCounters {
+    uint64_t cycles;
+    uint64_t instret;
+    uint64_t instLimit;
+    uint64_t bbvInterval;
+    uint64_t commitTrace;
+};
+
+// while the core is halted
+static CoreCounters readCoreCounters(int core) {
+    uint64_t fake_buffer[8] = {0};
+    request(READ, coreComponent(core, REGISTER_FILE_ID), RF_COUNTERS, fake_buffer);
+    return {receivedData[0], receivedData[1], receivedData[2], receivedData[3], receivedData[4]};
+}
+
+static void writeCoreCounters(int core, const CoreCounters &counters) {
+    uint64_t write_buffer[8] = {counters.cycles, counters.instret, counters.instLimit, counters.bbvInterval, counters.commitTrace};
+    request(WRITE, coreComponent(core, REGISTER_FILE_ID), RF_COUNTERS, write_buffer);
+}
+
+// cycles and instret of core 0, then of the other cores as core<i>_cycles ...
+static std::vector<std::pair<std::string, uint64_t>> readCounters() {
+    std::vector<std::pair<std::string, uint64_t>> values;
+    for (int core = 0; core < CORE_COUNT; ++core) {
+        std::string prefix = core == 0 ? "" : "core" + std::to_string(core) + "_";
+        CoreCounters counters = readCoreCounters(core);
+        values.emplace_back(prefix + "cycles", counters.cycles);
+        values.emplace_back(prefix + "instret", counters.instret);
+    }
+    for (const auto &counter : memCounters) {
+        values.emplace_back(counter.first, readMemSystem(counter.second));
+    }
+    return values;
+}
+
+static void printCounters() {
+    for (const auto &counter : readCounters()) {
+        printf("%s %lu\n", counter.first.c_str(), counter.second);
+    }
+}
+
+// From a halted, canonical state: runs until core 0 has committed `instructions` more
+// instructions. The hardware then halts and canonicalizes every core by itself, with
+// nothing committed past the limit. Returns false if the program exits first; the cores
+// are halted and canonicalized here then. `committed` is what core 0 really committed.
+static bool runInstructions(uint64_t instructions, uint64_t &committed) {
+    committed = 0;
+    if (instructions == 0) {
+        return true;
+    }
+    CoreCounters counters = readCoreCounters(0);
+    uint64_t start = counters.instret;
+    counters.instLimit = counters.instret + instructions;
+    writeCoreCounters(0, counters);
+
+    window_flag.store(0);
+    restart();
+    while (window_flag.load() == 0 && quit_flag.load() != 0);
+
+    bool complete = window_flag.load() != 0;
+    if (!complete) {
+        halt();
+        canonicalize(false);
+    }
+
+    counters = readCoreCounters(0);
+    counters.instLimit = 0;
+    writeCoreCounters(0, counters);
+    committed = counters.instret - start;
+    return complete;
+}
+
+// A detailed simulation window: warmup instructions, then `length` instructions whose
+// counters are printed as "window <counter> <value>" (see readCounters). "window complete 0"
+// means the program exited before the end of the window.
+static void runWindow(uint64_t warmup, uint64_t length) {
+    uint64_t committed;
+    bool complete = runInstructions(warmup, committed);
+    auto before = readCounters();
+    if (complete) {
+        complete = runInstructions(length, committed);
+    }
+    auto after = readCounters();
+    printf("window complete %d\n", complete ? 1 : 0);
+    for (size_t i = 0; i < after.size(); ++i) {
+        printf("window %s %lu\n", after[i].first.c_str(), after[i].second - before[i].second);
+    }
+    fflush(stdout);
+}
+
+// Basic-block vectors of every core after each `interval` instructions it commits, into
+// path (core 0) and path.core<i>; 0 stops the collection. While halted.
+static void collectBbv(uint64_t interval, const std::string &path) {
+    for (int core = 0; core < CORE_COUNT; ++core) {
+        CoreCounters counters = readCoreCounters(core);
+        counters.bbvInterval = interval;
+        writeCoreCounters(core, counters);
+    }
+
+    std::lock_guard<std::mutex> guard(bbvLock);
+    for (int core = 0; core < CORE_COUNT; ++core) {
+        if (bbvFiles[core] != NULL) {
+            fclose(bbvFiles[core]);
+            fclose(bbvLengthFiles[core]);
+            bbvFiles[core] = NULL;
+            bbvLengthFiles[core] = NULL;
+        }
+        if (interval != 0) {
+            std::string corePath = core == 0 ? path : path + ".core" + std::to_string(core);
+            bbvFiles[core] = fopen(corePath.c_str(), "w");
+            bbvLengthFiles[core] = fopen((corePath + ".len").c_str(), "w");
+            if (bbvFiles[core] == NULL || bbvLengthFiles[core] == NULL) {
+                fprintf(stderr, "Cannot write %s\n", corePath.c_str());
+                exit(1);
+            }
+        }
+    }
+}
+
+// A banked cache has setCount sets per bank. The bank index is placed above the way
+// index in the address, and "data" lists the sets of bank 0 first, then bank 1, ...
+static json extractSpecificCache(uint8_t id, int log2SetCount, int log2WayCount, int log2BankCount = 0) {
     json cache;
 
     int setCount = 1 << log2SetCount;
     int wayCount = 1 << log2WayCount;
+    int bankCount = 1 << log2BankCount;
 
     cache["set"] = setCount;
     cache["way"] = wayCount;    
+    cache["bank"] = bankCount;
 
+    for(int bank = 0; bank < bankCount; ++bank)
     for(int set = 0; set < setCount; ++set) {
         json set_results;
-
-        uint64_t lru_addr = 0x0 | (set << 2);
-        uint64_t fake_buffer[8] = {0};
-
-        request(READ, id, lru_addr, fake_buffer);
-
-        assert(wayCount < 64); 
-        uint64_t lru = receivedData[0];
+        uint64_t bank_bits = (uint64_t)bank << (2 + log2SetCount + log2WayCount);
+
+        // the metadata and the tags of all the ways come in one response
+        uint64_t set_addr = 0x3 | (set << 2) | bank_bits;
+        assert(wayCount < 8);
+        uint64_t set_metadata[8];
+        const uint64_t *set_state = readState(id, set_addr);
+        std::copy(set_state, set_state + 8, set_metadata);
+        uint64_t lru = set_metadata[0];
         set_results["lru"] = lru;
 
         for (int way = 0; way < wayCount; ++way) {
             json way_result;
-            uint64_t tag_addr = 0x1 | (set << 2) | (way << (2 + log2SetCount));
-            request(READ, id, tag_addr, fake_buffer);
-            uint64_t tag_metadata = receivedData[0];
+            uint64_t tag_metadata = set_metadata[1 + way];
 
             uint64_t flag = tag_metadata & 0x3;
             if (flag == 0) { // not valid
@@ -225,11 +791,12 @@ static json extractSpecificCache(uint8_t id, int log2SetCount, int log2WayCount)
             uint64_t tag = (tag_metadata >> 2);
             way_result["tag"] = tag;
 
-            uint64_t data_addr = 0x2 | (set << 2) | (way << (2 + log2SetCount));
-            request(READ, id, data_addr, fake_buffer);
+            // an invalid line keeps zero data in the file
             uint64_t data[8] = {0};
-            for (int i = 0; i < 8; ++i) {
-                data[i] = receivedData[i];
+            if (flag != 0) {
+                uint64_t data_addr = 0x2 | (set << 2) | (way << (2 + log2SetCount)) | bank_bits;
+                const uint64_t *line = readState(id, data_addr);
+                std::copy(line, line + 8, data);
             }
 
             for (int i = 0; i < 8; ++i) {
@@ -246,30 +813,48 @@ static json extractSpecificCache(uint8_t id, int log2SetCount, int log2WayCount)
 
 }
 
-static void loadCache(const json& cache, uint8_t id) {
+// The geometry of the build, as for extractSpecificCache. A section with the same ways
+// and the same number of sets over all its banks is loaded into the banks of the build
+// (a line keeps its tag: the bank and set bits are the same low bits of the line
+// address), so the unbanked L2 sections of older snapshots still load. Any other
+// geometry is not loaded: the cache stays empty, and its dirty lines are lost.
+static void loadCache(const json& cache, uint8_t id, int log2SetCount, int log2WayCount, int log2BankCount = 0) {
     int setCount = cache["set"];
     int wayCount = cache["way"];
+    int bankCount = cache.value("bank", 1);
 
-    int log2SetCount = 0;
-    while ((1 << log2SetCount) < setCount) {
-        ++log2SetCount;
+    int log2SavedSets = 0;
+    while ((1 << log2SavedSets) < setCount) {
+        ++log2SavedSets;
     }
-
-    int log2WayCount = 0;
-    while ((1 << log2WayCount) < wayCount) {
-        ++log2WayCount;
+    int log2SavedBanks = 0;
+    while ((1 << log2SavedBanks) < bankCount) {
+        ++log2SavedBanks;
+    }
+    if (wayCount != (1 << log2WayCount) || setCount != (1 << log2SavedSets) || bankCount != (1 << log2SavedBanks)
+            || log2SavedSets + log2SavedBanks != log2SetCount + log2BankCount) {
+        fprintf(stderr, "Cache %d: the snapshot has %d banks of %d sets of %d ways, the build %d of %d of %d; not loaded\n",
+                id, bankCount, setCount, wayCount, 1 << log2BankCount, 1 << log2SetCount, 1 << log2WayCount);
+        return;
     }
 
     auto data = cache["data"];
-    for (int set = 0; set < setCount; ++set) {
-        auto set_results = data[set];
+    for (int savedBank = 0; savedBank < bankCount; ++savedBank)
+    for (int savedSet = 0; savedSet < setCount; ++savedSet) {
+        auto set_results = data[savedBank * setCount + savedSet];
+        uint64_t index = ((uint64_t)savedSet << log2SavedBanks) | savedBank;
+        uint64_t bank = index & ((1 << log2BankCount) - 1);
+        uint64_t set = index >> log2BankCount;
         uint64_t lru = set_results["lru"];
+        uint64_t bank_bits = bank << (2 + log2SetCount + log2WayCount);
 
-        uint64_t lru_addr = 0x0 | (set << 2);
+        uint64_t set_addr = 0x3 | (set << 2) | bank_bits;
 
-        uint64_t write_buffer[8] = {0};
-        write_buffer[0] = lru;
-        request(WRITE, id, lru_addr, write_buffer);  
+        // the metadata and the tags of all the ways go in one request. The caches have
+        // been invalidated, so an all-zero set is already there.
+        assert(wayCount < 8);
+        uint64_t set_buffer[8] = {0};
+        set_buffer[0] = lru;
 
         auto lines = set_results["lines"];
         for (int way = 0; way < wayCount; ++way) {
@@ -277,60 +862,228 @@ static void loadCache(const json& cache, uint8_t id) {
             bool valid = way_result["valid"];
             bool dirty = way_result["dirty"];
             uint64_t tag = way_result["tag"];
-
-            uint64_t tag_addr = 0x1 | (set << 2) | (way << (2 + log2SetCount));
-            uint64_t tag_metadata = (tag << 2);
             if (valid) {
-                if (dirty) {
-                    tag_metadata |= 0x2;
-                } else {
-                    tag_metadata |= 0x1;
-                }
-            } else {
-                tag_metadata |= 0x0;
+                set_buffer[1 + way] = (tag << 2) | (dirty ? 0x2 : 0x1);
             }
+        }
+        if (std::any_of(set_buffer, set_buffer + 8, [](uint64_t word) { return word != 0; })) {
+            writeState(id, set_addr, set_buffer);
+        }
 
-            write_buffer[0] = tag_metadata;
-            request(WRITE, id, tag_addr, write_buffer);
+        uint64_t write_buffer[8] = {0};
+        for (int way = 0; way < wayCount; ++way) {
+            auto way_result = lines[way];
+            bool valid = way_result["valid"];
+            if (!valid) {
+                continue;
+            }
 
             auto data = way_result["data"];
             for (int i = 0; i < 8; ++i) {
                 write_buffer[i] = data[i];
             }
 
-            uint64_t data_addr = 0x2 | (set << 2) | (way << (2 + log2SetCount));
-            request(WRITE, id, data_addr, write_buffer);
+            uint64_t data_addr = 0x2 | (set << 2) | (way << (2 + log2SetCount)) | bank_bits;
+            writeState(id, data_addr, write_buffer);
             
         }
     }
 }
 
-static std::array<json, 3> saveCache() {
-    json l1i;
-    json l1d;
-    json l2;
+// Open row of each DRAM bank (bit 32 set if a row is open) and the cycles left before
+// the next refresh. The DRAM queue is empty once the memory is halted.
+static json saveDram() {
+    json dram;
+    for (uint64_t bank = 0; bank < DRAM_BANKS; ++bank) {
+        dram["open_row"].emplace_back(readState(MAIN_MEM_ID, DRAM_STATE_BASE | bank)[0]);
+    }
+    dram["refresh_in"] = readState(MAIN_MEM_ID, DRAM_STATE_BASE | DRAM_BANKS)[0];
+    return dram;
+}
 
-    l1i = extractSpecificCache(L1I_ID, L1I_SET_COUNT_LOG2, L1I_WAY_LOG2);
-    l1d = extractSpecificCache(L1D_ID, L1D_SET_COUNT_LOG2, L1D_WAY_LOG2);
-    l2 = extractSpecificCache(L2_ID, L2_SET_COUNT_LOG2, L2_WAY_LOG2);
+static void loadDram(const json& dram) {
+    uint64_t write_buffer[8] = {0};
+    for (uint64_t bank = 0; bank < DRAM_BANKS; ++bank) {
+        write_buffer[0] = dram["open_row"][bank];
+        writeState(MAIN_MEM_ID, DRAM_STATE_BASE | bank, write_buffer);
+    }
+    write_buffer[0] = dram["refresh_in"];
+    writeState(MAIN_MEM_ID, DRAM_STATE_BASE | DRAM_BANKS, write_buffer);
+}
 
-    return {l1i, l1d, l2};
+// The PC and the registers of a core and, withCaches, its L1s.
+static json saveCore(int core, bool withCaches) {
+    json state;
+
+    // the PC and x1-x15, then x16-x31, register i of a group in bits [32i+31:32i]
+    for(uint64_t group = 0; group < RF_SIZE / RF_PER_TRANSFER; group++){
+        const uint64_t *regs = readState(coreComponent(core, REGISTER_FILE_ID), RF_PACKED | (group * RF_PACKED_GROUP));
+        for(uint64_t i = 0; i < RF_PER_TRANSFER; i++){
+            uint32_t value = regs[i / 2] >> (32 * (i % 2));
+            if (group == 0 && i == 0) {
+                state["PC"] = value;
+            } else {
+                state["RegisterFile"].emplace_back(value);
+            }
+        }
+    }
+
+    if (withCaches) {
+        state["L1i"] = extractSpecificCache(coreComponent(core, L1I_ID), L1I_SET_COUNT_LOG2, L1I_WAY_LOG2);
+        state["L1d"] = extractSpecificCache(coreComponent(core, L1D_ID), L1D_SET_COUNT_LOG2, L1D_WAY_LOG2);
+    }
+    return state;
 }
 
-static void exportSnapshot(std::ostream &s){
-    json snapshot;
-    uint64_t temporal_buffer[8] = {0}; 
+// withL1d = false leaves the L1d empty, see loadDirectory
+static void loadCore(const json &state, int core, bool withL1d) {
+    uint64_t write_buffer[8] = {0};
+    for(uint64_t group = 0; group < RF_SIZE / RF_PER_TRANSFER; group++){
+        std::fill(write_buffer, write_buffer + 8, 0);
+        for(uint64_t i = 0; i < RF_PER_TRANSFER; i++){
+            uint64_t reg = group * RF_PER_TRANSFER + i;
+            uint64_t value = reg == 0 ? state["PC"].get<uint64_t>() : state["RegisterFile"][reg - 1].get<uint64_t>();
+            write_buffer[i / 2] |= (value & 0xFFFFFFFF) << (32 * (i % 2));
+        }
+        writeState(coreComponent(core, REGISTER_FILE_ID), RF_PACKED | (group * RF_PACKED_GROUP), write_buffer);
+    }
 
-    request(READ, CORE_ID, 0, temporal_buffer);
-    snapshot["PC"] = receivedData[0];
-    
-    for(uint64_t i = 1; i < RF_SIZE; i++){
-        request(READ, REGISTER_FILE_ID, i, temporal_buffer);
-        snapshot["RegisterFile"].emplace_back(receivedData[0]);
-        printf("Snapshot Register Status: %lu/%lu \r", i, RF_SIZE);
+    if (state.contains("L1i")) {
+        loadCache(state["L1i"], coreComponent(core, L1I_ID), L1I_SET_COUNT_LOG2, L1I_WAY_LOG2);
+        if (withL1d) {
+            loadCache(state["L1d"], coreComponent(core, L1D_ID), L1D_SET_COUNT_LOG2, L1D_WAY_LOG2);
+        }
     }
-    puts("");
+}
 
+// The valid directory entries as [index, entry], with the core count of the build: the
+// sharer bits of an entry only make sense with the same number of cores.
+static json saveDirectory() {
+    json directory;
+    directory["cores"] = CORE_COUNT;
+    directory["entries"] = json::array();
+    for (uint64_t index = 0; index < (1 << DIRECTORY_ENTRIES_LOG2); ++index) {
+        uint64_t entry = readState(DIRECTORY_ID, index)[0];
+        if ((entry & 0x3) != 0) {
+            directory["entries"].push_back({index, entry});
+        }
+    }
+    return directory;
+}
+
+// The L1ds of a multi-core build can only be loaded with the directory that tracks
+// their lines. Returns false when the snapshot has none for this core count; the L1ds
+// then stay empty and their dirty lines are lost (a memory-only snapshot moves between
+// builds with any number of cores).
+static bool loadDirectory(const json &snapshot) {
+    if (CORE_COUNT == 1) {
+        return true;
+    }
+    if (!snapshot.contains("Directory") || snapshot["Directory"]["cores"] != CORE_COUNT) {
+        fprintf(stderr, "The snapshot has no directory for %d cores, the L1ds are not loaded\n", CORE_COUNT);
+        return false;
+    }
+    // the directory has been invalidated with the caches, only the valid entries are written
+    uint64_t write_buffer[8] = {0};
+    for (const auto &entry : snapshot["Directory"]["entries"]) {
+        write_buffer[0] = entry[1];
+        writeState(DIRECTORY_ID, entry[0], write_buffer);
+    }
+    return true;
+}
+
+#ifdef DMA_MAINMEM
+// Main memory lives in this buffer, the hardware reaches it with DMA. Its size in MB
+// comes from MAIN_MEM_MB (at most 4096, the reach of a 26-bit line address), rounded
+// down to a power of two: the hardware wraps the line addresses at it, like the BRAM.
+static int hostMemoryFd = -1;
+static char *hostMemory = 0;
+static uint64_t hostMemoryLines = 0;
+
+// memlines.vmh: "@<line>" in hex, then one line per row, lowest byte rightmost
+static void loadHostMemory(const char *path) {
+    std::ifstream file(path);
+    std::string row;
+    uint64_t line = 0;
+    while (std::getline(file, row)) {
+        while (!row.empty() && isspace((unsigned char)row.back())) {
+            row.pop_back();
+        }
+        if (row.empty()) {
+            continue;
+        }
+        if (row[0] == '@') {
+            line = row.size() > 1 ? std::stoull(row.substr(1), nullptr, 16) : 0;
+            continue;
+        }
+        if (line >= hostMemoryLines) {
+            break;
+        }
+        uint8_t *bytes = (uint8_t *)hostMemory + line * MAIN_MEM_LINE_BYTES;
+        for (size_t i = 0; i < MAIN_MEM_LINE_BYTES && 2 * i < row.size(); i++) {
+            size_t end = row.size() - 2 * i;
+            size_t start = end >= 2 ? end - 2 : 0;
+            bytes[i] = std::stoul(row.substr(start, end - start), nullptr, 16);
+        }
+        line++;
+    }
+}
+
+static void initHostMemory() {
+    const char *mb = getenv("MAIN_MEM_MB");
+    uint64_t size = (mb ? strtoull(mb, nullptr, 0) : DMA_MAIN_MEM_MB) << 20;
+    size = std::min(std::max(size, (uint64_t)MAIN_MEM_LINE_BYTES), DMA_MAIN_MEM_MAX_BYTES);
+    while (size & (size - 1)) {
+        size &= size - 1;
+    }
+
+    DmaManager *dma = dmaManager = platformInit();
+    hostMemoryFd = portalAlloc(size, 0);
+    hostMemory = (char *)portalMmap(hostMemoryFd, size);
+    hostMemoryLines = size / MAIN_MEM_LINE_BYTES;
+    memset(hostMemory, 0, size);
+    loadHostMemory("memlines.vmh");
+    portalCacheFlush(hostMemoryFd, hostMemory, size, 1);
+    coreRequestProxy->setDmaRef(dma->reference(hostMemoryFd), hostMemoryLines);
+    initStreamBuffer();
+    fprintf(stderr, "Main memory: %lu MB of host memory\n", size >> 20);
+}
+#endif
+
+// MainMemFile is relative to the directory of the snapshot, so that a snapshot and its
+// memory can be moved or loaded from another working directory together.
+static std::string mainMemFileName(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return (slash == std::string::npos ? path : path.substr(slash + 1)) + ".mem";
+}
+
+// Older snapshots hold the path as written, relative to the working directory of the save.
+static std::string mainMemFilePath(const json &snapshot, const std::string &path) {
+    std::string memPath = snapshot["MainMemFile"];
+    size_t slash = path.rfind('/');
+    if (memPath.empty() || memPath[0] == '/' || slash == std::string::npos) {
+        return memPath;
+    }
+    std::string resolved = path.substr(0, slash + 1) + memPath;
+    return access(resolved.c_str(), R_OK) == 0 || access(memPath.c_str(), R_OK) != 0 ? resolved : memPath;
+}
+
+// Main memory is saved as raw bytes next to the snapshot (<path>.mem, memcpy speed)
+// when it lives in host memory, and in the JSON otherwise. Both kinds load with either build.
+static void saveMainMem(json &snapshot, const std::string &path) {
+#ifdef DMA_MAINMEM
+    std::string memPath = path + ".mem";
+    FILE *memFile = fopen(memPath.c_str(), "wb");
+    if (memFile == NULL || fwrite(hostMemory, MAIN_MEM_LINE_BYTES, hostMemoryLines, memFile) != hostMemoryLines) {
+        fprintf(stderr, "Cannot write %s\n", memPath.c_str());
+    }
+    if (memFile != NULL) {
+        fclose(memFile);
+    }
+    snapshot["MainMemFile"] = mainMemFileName(path);
+    snapshot["MainMemLines"] = hostMemoryLines;
+#else
+    uint64_t temporal_buffer[8] = {0};
     for(uint64_t i = 0; i < MAIN_MEM_SIZE; i++){
         request(READ, MAIN_MEM_ID, i, temporal_buffer);
         for (int j = 0; j < 8; j++) {
@@ -339,46 +1092,251 @@ static void exportSnapshot(std::ostream &s){
         printf("Snapshot Memory Status: %lu/%lu \r", i, MAIN_MEM_SIZE);
     }
     puts("");
+#endif
+}
 
-    auto caches = saveCache();
-    snapshot["L1i"] = caches[0];
-    snapshot["L1d"] = caches[1];
-    snapshot["L2"] = caches[2];
-    
-    s << std::setw(4) << snapshot << std::endl;
+static void loadMainMemLine(uint64_t i, const uint64_t data[8]) {
+#ifdef DMA_MAINMEM
+    if (i < hostMemoryLines) {
+        memcpy(hostMemory + i * MAIN_MEM_LINE_BYTES, data, MAIN_MEM_LINE_BYTES);
+    }
+#else
+    if (i < MAIN_MEM_SIZE) {
+        request(WRITE, MAIN_MEM_ID, i, data);
+        printf("Load Memory Status: %lu/%lu \r", i, MAIN_MEM_SIZE);
+    }
+#endif
 }
 
-static void importSnapshot(std::istream &s){
-    json snapshot;
+// path: the snapshot file, MainMemFile is relative to its directory
+static void loadMainMem(const json &snapshot, const std::string &path) {
     uint64_t write_buffer[8] = {0};
 
-    s >> snapshot;
+    if (snapshot.contains("MainMemFile")) {
+        std::string memPath = mainMemFilePath(snapshot, path);
+        FILE *memFile = fopen(memPath.c_str(), "rb");
+        if (memFile == NULL) {
+            fprintf(stderr, "Cannot read %s\n", memPath.c_str());
+            return;
+        }
+#ifdef DMA_MAINMEM
+        memset(hostMemory, 0, hostMemoryLines * MAIN_MEM_LINE_BYTES);
+        size_t lines = fread(hostMemory, MAIN_MEM_LINE_BYTES, hostMemoryLines, memFile);
+        (void)lines;
+#else
+        for (uint64_t i = 0; i < MAIN_MEM_SIZE && fread(write_buffer, MAIN_MEM_LINE_BYTES, 1, memFile) == 1; i++) {
+            loadMainMemLine(i, write_buffer);
+        }
+#endif
+        fclose(memFile);
+    } else {
+        for(uint64_t i = 0; i < snapshot["MainMem"].size(); i++){
+            auto data = snapshot["MainMem"][i];
+            for(int j = 0; j < 8; j++){
+                write_buffer[j] = data[j];
+            }
+            loadMainMemLine(i, write_buffer);
+        }
+    }
+    puts("");
 
-    write_buffer[0] = snapshot["PC"];
-    request(WRITE, CORE_ID, 0, write_buffer);
+#ifdef DMA_MAINMEM
+    // the on-chip line cache of the memory is dropped at restart
+    portalCacheFlush(hostMemoryFd, hostMemory, hostMemoryLines * MAIN_MEM_LINE_BYTES, 1);
+#endif
+}
 
-    for(uint64_t i = 1; i < RF_SIZE; i++){
-        write_buffer[0] = snapshot["RegisterFile"][i-1];
-        request(WRITE, REGISTER_FILE_ID, i, write_buffer);
-        printf("Load Register Status: %lu/%lu \r", i, RF_SIZE);
+static uint64_t mainMemLines() {
+#ifdef DMA_MAINMEM
+    return hostMemoryLines;
+#else
+    return MAIN_MEM_SIZE;
+#endif
+}
+
+// The commit trace of every core on or off, while halted.
+static void setCommitTrace(bool enable) {
+    for (int core = 0; core < CORE_COUNT; ++core) {
+        CoreCounters counters = readCoreCounters(core);
+        counters.commitTrace = enable ? 1 : 0;
+        writeCoreCounters(core, counters);
     }
+}
 
+// From a halted, canonical state: writes the dirty cache lines back, starts the golden
+// model from the registers and the memory, and turns the commit trace on.
+static void startCosim() {
+    flushCaches(false);
+
+    std::vector<GoldenHart> harts(CORE_COUNT);
+    for (int core = 0; core < CORE_COUNT; ++core) {
+        json state = saveCore(core, false);
+        harts[core].pc = state["PC"];
+        for (int reg = 1; reg < (int)RF_SIZE; ++reg) {
+            harts[core].x[reg] = state["RegisterFile"][reg - 1];
+        }
+    }
+    std::vector<uint8_t> memory(mainMemLines() * MAIN_MEM_LINE_BYTES);
+#ifdef DMA_MAINMEM
+    memcpy(memory.data(), hostMemory, memory.size());
+#else
+    for (uint64_t i = 0; i < MAIN_MEM_SIZE; i++) {
+        memcpy(memory.data() + i * MAIN_MEM_LINE_BYTES, readState(MAIN_MEM_ID, i), MAIN_MEM_LINE_BYTES);
+        printf("Co-simulation Memory Status: %lu/%lu \r", i, MAIN_MEM_SIZE);
+    }
     puts("");
+#endif
+
+    {
+        std::lock_guard<std::mutex> guard(cosimLock);
+        cosimHarts.swap(harts);
+        cosimMemory.swap(memory);
+        cosimDiverged = false;
+        cosimActive = true;
+    }
+    setCommitTrace(true);
+    if (readCoreCounters(0).commitTrace == 0) {
+        printf("This build does not trace its commits (DUAL_ISSUE)\n");
+        std::lock_guard<std::mutex> guard(cosimLock);
+        cosimActive = false;
+    }
+}
 
-    for(uint64_t i = 0; i < MAIN_MEM_SIZE; i++){
-        auto data = snapshot["MainMem"][i];
-        for(int j = 0; j < 8; j++){
-            write_buffer[j] = data[j];
+// While halted: turns the commit trace off and prints how far each core was checked.
+// Returns false if the co-simulation was not running.
+static bool stopCosim() {
+    {
+        std::lock_guard<std::mutex> guard(cosimLock);
+        if (!cosimActive) {
+            return false;
         }
-        request(WRITE, MAIN_MEM_ID, i, write_buffer);
-        printf("Load Memory Status: %lu/%lu \r", i, MAIN_MEM_SIZE);
     }
+    setCommitTrace(false);
 
-    puts("");
+    std::lock_guard<std::mutex> guard(cosimLock);
+    cosimActive = false;
+    for (int core = 0; core < CORE_COUNT; ++core) {
+        printf("cosim: core %d: %lu instructions checked\n", core, cosimHarts[core].checked);
+    }
+    printf("cosim: %s\n", cosimDiverged ? "diverged" : "no divergence");
+    return true;
+}
+
+// withCaches = false saves the registers and main memory only. The caches must have
+// been flushed, and they are invalidated when such a snapshot is loaded.
+// With forkMemory the memory is not saved here: the snapshot points to <path>.mem,
+// which forkSnapshot writes in the background.
+static void exportSnapshot(std::ostream &s, const std::string &path, bool withCaches = true, bool forkMemory = false){
+    json snapshot;
+
+#ifdef DMA_MAINMEM
+    // the hardware dumps all the state in one go, the walk below reads the buffer
+    streamSnapshot(false);
+    stateStream = true;
+#endif
+
+    // A single-core build keeps the layout of the older snapshots: the state of the core
+    // at the top level. Otherwise one entry per core in "Cores".
+    if (CORE_COUNT == 1) {
+        snapshot = saveCore(0, withCaches);
+    } else {
+        for (int core = 0; core < CORE_COUNT; ++core) {
+            snapshot["Cores"].emplace_back(saveCore(core, withCaches));
+        }
+    }
+
+    if (forkMemory) {
+        snapshot["MainMemFile"] = mainMemFileName(path);
+        snapshot["MainMemLines"] = mainMemLines();
+    } else {
+        saveMainMem(snapshot, path);
+    }
+
+    if (withCaches) {
+        snapshot["L2"] = extractSpecificCache(L2_ID, L2_SET_COUNT_LOG2, L2_WAY_LOG2, L2_BANK_LOG2);
+        if (CORE_COUNT > 1) {
+            snapshot["Directory"] = saveDirectory();
+        }
+    }
+    snapshot["Dram"] = saveDram();
 
-    loadCache(snapshot["L1i"], L1I_ID);
-    loadCache(snapshot["L1d"], L1D_ID);
-    loadCache(snapshot["L2"], L2_ID);
+#ifdef DMA_MAINMEM
+    stateStream = false;
+#endif
+    
+    s << std::setw(4) << snapshot << std::endl;
+}
+
+// After canonicalize: saves the registers and the caches, then takes the image of main
+// memory and restarts the core right away. The BRAM starts a copy-on-write walk (see
+// MainMem.bsv); host memory is copied here, the writes go straight through to it, and
+// only the file is written in the background.
+static void forkSnapshot(const std::string &path) {
+    if (forkActive.load()) {
+        printf("A fork snapshot is still being written\n");
+        return;
+    }
+    std::ofstream file(path);
+    exportSnapshot(file, path, true, true);
+    file.close();
+
+    forkPath = path + ".mem";
+    forkActive.store(true);
+#ifdef DMA_MAINMEM
+    forkImage.resize(hostMemoryLines * 8);
+    memcpy(forkImage.data(), hostMemory, hostMemoryLines * MAIN_MEM_LINE_BYTES);
+    restart();
+    std::thread(writeForkImage).detach();
+#else
+    forkImage.assign(mainMemLines() * 8, 0);
+    coreRequestProxy->fork(mainMemLines());
+    restart();
+#endif
+}
+
+static void importSnapshot(std::istream &s, const std::string &path){
+    json snapshot;
+
+    s >> snapshot;
+
+    // empty the caches first: only the valid lines of the snapshot are written, and
+    // with a memory-only snapshot no dirty line overwrites the loaded memory later
+    invalidateCaches();
+
+#ifdef DMA_MAINMEM
+    // start from the current (empty) state, the writes below go to the buffer and
+    // the hardware loads all of it at the end
+    streamSnapshot(false);
+    stateStream = true;
+#endif
+
+    loadMainMem(snapshot, path);
+
+    bool withL1d = !snapshot.contains("L2") || loadDirectory(snapshot);
+    if (snapshot.contains("Cores")) {
+        // a snapshot of a build with more cores loses the extra ones, with fewer cores
+        // the other cores keep their state
+        const json &cores = snapshot["Cores"];
+        if ((int)cores.size() > CORE_COUNT) {
+            fprintf(stderr, "The snapshot has %zu cores, only the first %d are loaded\n", cores.size(), CORE_COUNT);
+        }
+        for (int core = 0; core < CORE_COUNT && core < (int)cores.size(); ++core) {
+            loadCore(cores[core], core, withL1d);
+        }
+    } else {
+        loadCore(snapshot, 0, withL1d);
+    }
+    if (snapshot.contains("L2")) {
+        loadCache(snapshot["L2"], L2_ID, L2_SET_COUNT_LOG2, L2_WAY_LOG2, L2_BANK_LOG2);
+    }
+    if (snapshot.contains("Dram")) {
+        loadDram(snapshot["Dram"]);
+    }
+
+#ifdef DMA_MAINMEM
+    stateStream = false;
+    streamSnapshot(true);
+#endif
 }
 
 
@@ -397,6 +1355,10 @@ int main(int argc, const char **argv)
 
     uart_buf = new Buffer();
 
+#ifdef DMA_MAINMEM
+    initHostMemory();
+#endif
+
 
     int status = setClockFrequency(0, requestedFrequency, &actualFrequency);
     fprintf(stderr, "Requested main clock frequency %5.2f, actual clock frequency %5.2f MHz status=%d errno=%d\n",
@@ -405,12 +1367,12 @@ int main(int argc, const char **argv)
 	    status, (status != 0) ? errno : 0);
 
 
-    // s[ave], l[oad], h[alt], r[estart], c[anonicalize], q[uit]
+    // s[ave], sm / save-memory, sf / save-fork, l[oad], h[alt], r[estart], c[anonicalize], cs / squash, f[lush], fi / flush-invalidate, i[nvalidate], p[erf], o[ption], bb / bbv, ri / run-instructions, wd / window, cm / cosim, q[uit]
     char userChar;
     std::string command;
 
     while (true) {
-        std::cout << "Enter command (s[ave], l[oad], h[alt], r[estart], c[anonicalize], w[rite], q[uit]): " << std::endl;
+        std::cout << "Enter command (s[ave], sm/save-memory, sf/save-fork, l[oad], h[alt], r[estart], c[anonicalize], cs/squash, f[lush], fi/flush-invalidate, i[nvalidate], w[rite], p[erf], o[ption], bb/bbv, ri/run-instructions, wd/window, cm/cosim, q[uit]): " << std::endl;
         std::cin >> command;
         if (command == "w" || command == "write") {
             std::cout << "Please enter a character: ";
@@ -422,16 +1384,42 @@ int main(int argc, const char **argv)
             std::cin >> filePath;
 
             std::ofstream file(filePath);
-            exportSnapshot(file);
+            exportSnapshot(file, filePath);
             file.flush();
             file.close();
+        } else if (command == "sm" || command == "save-memory") {
+            std::string filePath;
+            std::cout << "Enter the file path to save: ";
+            std::cin >> filePath;
+
+            flushCaches(false);
+            std::ofstream file(filePath);
+            exportSnapshot(file, filePath, false);
+            file.flush();
+            file.close();
+        } else if (command == "sf" || command == "save-fork") {
+            std::string filePath;
+            std::cout << "Enter the file path to save: ";
+            std::cin >> filePath;
+
+            forkSnapshot(filePath);
+        } else if (command == "f" || command == "flush") {
+            flushCaches(false);
+        } else if (command == "fi" || command == "flush-invalidate") {
+            flushCaches(true);
+        } else if (command == "i" || command == "invalidate") {
+            invalidateCaches();
         } else if (command == "l" || command == "load") {
             std::string filePath;
             std::cout << "Enter the file path to load: ";
             std::cin >> filePath;
 
+            // the golden model would start from the old state
+            if (stopCosim()) {
+                printf("Co-simulation stopped, start it again after the load\n");
+            }
             std::ifstream file(filePath);
-            importSnapshot(file);
+            importSnapshot(file, filePath);
             file.close();
 
         } else if (command == "h" || command == "halt") {
@@ -439,7 +1427,51 @@ int main(int argc, const char **argv)
         } else if (command == "r" || command == "restart") {
             restart();
         } else if (command == "c" || command == "canonicalize") {
-            canonicalize();
+            canonicalize(false);
+        } else if (command == "cs" || command == "squash") {
+            canonicalize(true);
+        } else if (command == "p" || command == "perf") {
+            printCounters();
+        } else if (command == "o" || command == "option") {
+            uint64_t addr, value;
+            std::cout << "Enter the register address: ";
+            std::cin >> addr;
+            std::cout << "Enter the value: ";
+            std::cin >> value;
+            writeMemSystem(addr, value);
+        } else if (command == "bb" || command == "bbv") {
+            uint64_t interval;
+            std::string filePath;
+            std::cout << "Enter the interval in instructions (0 stops): ";
+            std::cin >> interval;
+            if (interval != 0) {
+                std::cout << "Enter the output file: ";
+                std::cin >> filePath;
+            }
+            collectBbv(interval, filePath);
+        } else if (command == "ri" || command == "run-instructions") {
+            uint64_t instructions;
+            std::cout << "Enter the number of instructions: ";
+            std::cin >> instructions;
+            uint64_t committed;
+            if (!runInstructions(instructions, committed)) {
+                std::cout << "The program exited first" << std::endl;
+            }
+            std::cout << "Committed " << committed << " instructions" << std::endl;
+        } else if (command == "wd" || command == "window") {
+            uint64_t warmup, length;
+            std::cout << "Enter the warmup and window lengths in instructions: ";
+            std::cin >> warmup >> length;
+            runWindow(warmup, length);
+        } else if (command == "cm" || command == "cosim") {
+            int enable;
+            std::cout << "Enter 1 to check the commits against the golden model, 0 to stop: ";
+            std::cin >> enable;
+            if (enable != 0) {
+                startCosim();
+            } else if (!stopCosim()) {
+                std::cout << "The co-simulation is not running" << std::endl;
+            }
         } else if (command == "q" || command == "quit") {
             break;
         } else {
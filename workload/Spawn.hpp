@@ -0,0 +1,208 @@
+// Runs a child process with a timeout, for the host tools that drive several simulators
+// from worker threads (workload/sampling, workload/regress).
+//
+// The child of a multi-threaded process may only make async-signal-safe calls between
+// fork() and exec: an allocation could wait forever on a lock that another thread held
+// at the fork. So the arguments, the environment and the paths are all built before
+// fork(), and the child only moves file descriptors, changes directory and calls execve.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+struct SpawnRequest {
+    // argv[0] is looked up in PATH unless it holds a '/'
+    std::vector<std::string> argv;
+    // working directory of the child, empty for the current one
+    std::string directory;
+    // NAME=value entries added to the environment, or replacing the same NAME
+    std::vector<std::string> environment;
+    // written to the standard input of the child, which is then closed
+    std::string input;
+    // the child's stderr goes to the same pipe as its stdout, otherwise it is inherited
+    bool mergeStderr = false;
+    // seconds before the child and its process group are killed, 0 for no limit
+    unsigned timeout = 0;
+};
+
+struct SpawnResult {
+    bool timedOut = false;
+    // exit status of the child, -1 if it did not exit normally
+    int status = -1;
+    // set if the child could not be started or fed
+    std::string error;
+};
+
+// the path execve needs for argv[0], empty if there is none
+static inline std::string findExecutable(const std::string &name) {
+    if (name.find('/') != std::string::npos) {
+        return name;
+    }
+    const char *path = getenv("PATH");
+    std::string directories = path != nullptr ? path : "/usr/bin:/bin";
+    size_t start = 0;
+    while (start <= directories.size()) {
+        size_t end = directories.find(':', start);
+        if (end == std::string::npos) {
+            end = directories.size();
+        }
+        std::string directory = end == start ? "." : directories.substr(start, end - start);
+        std::string candidate = directory + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+        start = end + 1;
+    }
+    return "";
+}
+
+// Starts the child in its own process group, writes the input, and hands every line of
+// its output (without the newline, the last one possibly unterminated) to onLine until
+// the child closes its output or the timeout runs out.
+static inline SpawnResult spawnWithTimeout(const SpawnRequest &request,
+                                           const std::function<void(const std::string &)> &onLine) {
+    // a child that exits before it reads its input must not kill the tool
+    static const bool ignoreSigpipe = signal(SIGPIPE, SIG_IGN) != SIG_ERR;
+    (void)ignoreSigpipe;
+    SpawnResult result;
+    auto start = std::chrono::steady_clock::now();
+
+    std::string executable = request.argv.empty() ? "" : findExecutable(request.argv[0]);
+    if (executable.empty()) {
+        result.error = "cannot find " + (request.argv.empty() ? std::string("a program") : request.argv[0]);
+        return result;
+    }
+    std::vector<char *> argv;
+    for (const auto &arg : request.argv) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    std::vector<char *> envp;
+    for (char **entry = environ; *entry != nullptr; ++entry) {
+        bool replaced = false;
+        for (const auto &added : request.environment) {
+            size_t name = added.find('=');
+            if (name != std::string::npos && strncmp(*entry, added.c_str(), name + 1) == 0) {
+                replaced = true;
+            }
+        }
+        if (!replaced) {
+            envp.push_back(*entry);
+        }
+    }
+    for (const auto &added : request.environment) {
+        envp.push_back(const_cast<char *>(added.c_str()));
+    }
+    envp.push_back(nullptr);
+    const char *directory = request.directory.empty() ? nullptr : request.directory.c_str();
+
+    int toChild[2], fromChild[2];
+    // close-on-exec: the children of the other workers must not keep these pipes open
+    if (pipe2(toChild, O_CLOEXEC) != 0) {
+        result.error = "pipe failed";
+        return result;
+    }
+    if (pipe2(fromChild, O_CLOEXEC) != 0) {
+        close(toChild[0]);
+        close(toChild[1]);
+        result.error = "pipe failed";
+        return result;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(toChild[0]);
+        close(toChild[1]);
+        close(fromChild[0]);
+        close(fromChild[1]);
+        result.error = "fork failed";
+        return result;
+    }
+    if (pid == 0) {
+        // its own process group, so that a timeout also stops the processes it starts
+        setpgid(0, 0);
+        dup2(toChild[0], 0);
+        dup2(fromChild[1], 1);
+        if (request.mergeStderr) {
+            dup2(fromChild[1], 2);
+        }
+        if (directory != nullptr && chdir(directory) != 0) {
+            _exit(127);
+        }
+        execve(executable.c_str(), argv.data(), envp.data());
+        _exit(127);
+    }
+    // also in the parent, so that the group exists whichever of the two runs first
+    setpgid(pid, pid);
+    close(toChild[0]);
+    close(fromChild[1]);
+
+    ssize_t written = write(toChild[1], request.input.data(), request.input.size());
+    close(toChild[1]);
+    if (written != (ssize_t)request.input.size()) {
+        result.error = "cannot write to the child";
+    }
+
+    std::string pending;
+    char buffer[4096];
+    while (true) {
+        int wait = -1;
+        if (request.timeout != 0) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            auto left = std::chrono::seconds(request.timeout) - elapsed;
+            if (left <= std::chrono::seconds(0)) {
+                result.timedOut = true;
+                break;
+            }
+            wait = std::chrono::duration_cast<std::chrono::milliseconds>(left).count() + 1;
+        }
+        struct pollfd fd = {fromChild[0], POLLIN, 0};
+        int ready = poll(&fd, 1, wait);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready == 0) {
+            result.timedOut = true;
+            break;
+        }
+        ssize_t count = read(fromChild[0], buffer, sizeof(buffer));
+        if (count <= 0) {
+            break;
+        }
+        pending.append(buffer, count);
+        size_t end;
+        while ((end = pending.find('\n')) != std::string::npos) {
+            onLine(pending.substr(0, end));
+            pending.erase(0, end + 1);
+        }
+    }
+    if (!pending.empty()) {
+        onLine(pending);
+    }
+    close(fromChild[0]);
+
+    if (result.timedOut && kill(-pid, SIGKILL) != 0) {
+        kill(pid, SIGKILL);
+    }
+    int status = 0;
+    pid_t waited;
+    while ((waited = waitpid(pid, &status, 0)) < 0 && errno == EINTR);
+    if (waited == pid && WIFEXITED(status)) {
+        result.status = WEXITSTATUS(status);
+    }
+    return result;
+}
@@ -0,0 +1,240 @@
+#include "CacheModel.hpp"
+
+#include <algorithm>
+
+#include <string.h>
+
+#include "../../CoreParameters.hpp"
+
+using json = nlohmann::json;
+
+bool parseReplacement(const std::string &name, Replacement &policy) {
+    if (name == "PLRU") {
+        policy = Replacement::PLRU;
+    } else if (name == "LRU") {
+        policy = Replacement::LRU;
+    } else if (name == "SRRIP") {
+        policy = Replacement::SRRIP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+CacheModel::CacheModel(int log2Sets, int log2Ways, int log2Banks, Replacement policy)
+    : log2Sets(log2Sets), log2Ways(log2Ways), log2Banks(log2Banks), fieldBits(std::max(2, log2Ways)), policy(policy),
+      tags(1u << (log2Banks + log2Sets + log2Ways), 0), states(tags.size(), Invalid), metadata(1u << (log2Banks + log2Sets), 0) {}
+
+// touch and victim of mkPLRU, mkTrueLRU and mkSRRIP, on the metadata word of a set
+uint32_t CacheModel::touch(uint32_t meta, uint32_t way, bool hit, bool replaced) const {
+    uint32_t fieldMask = (1u << fieldBits) - 1;
+    uint32_t ways = 1u << log2Ways;
+    auto field = [&](uint32_t i) { return (meta >> (i * fieldBits)) & fieldMask; };
+    auto setField = [&](uint32_t i, uint32_t value) {
+        meta = (meta & ~(fieldMask << (i * fieldBits))) | ((value & fieldMask) << (i * fieldBits));
+    };
+
+    switch (policy) {
+        case Replacement::PLRU: {
+            uint32_t node = 0;
+            for (int i = log2Ways - 1; i >= 0; --i) {
+                uint32_t bit = (way >> i) & 1;
+                meta = (meta & ~(1u << node)) | ((bit ^ 1) << node);
+                node = node * 2 + 1 + bit;
+            }
+            return meta;
+        }
+        case Replacement::LRU: {
+            // <= as in the hardware, which orders the all-zero reset value
+            uint32_t touched = field(way);
+            for (uint32_t i = 0; i < ways; ++i) {
+                uint32_t age = field(i);
+                if (i != way && age <= touched && age != ways - 1) {
+                    setField(i, age + 1);
+                }
+            }
+            setField(way, 0);
+            return meta;
+        }
+        case Replacement::SRRIP: {
+            if (hit) {
+                setField(way, 0);
+                return meta;
+            }
+            // over the victim: age every way until one is distant, as victim does;
+            // then insert with a long interval
+            if (replaced) {
+                uint32_t oldest = 0;
+                for (uint32_t i = 0; i < ways; ++i) {
+                    oldest = std::max(oldest, field(i));
+                }
+                for (uint32_t i = 0; i < ways; ++i) {
+                    setField(i, field(i) + 3 - oldest);
+                }
+            }
+            setField(way, 2);
+            return meta;
+        }
+    }
+    return meta;
+}
+
+uint32_t CacheModel::victim(uint32_t meta) const {
+    uint32_t fieldMask = (1u << fieldBits) - 1;
+    uint32_t ways = 1u << log2Ways;
+    auto field = [&](uint32_t i) { return (meta >> (i * fieldBits)) & fieldMask; };
+
+    switch (policy) {
+        case Replacement::PLRU: {
+            uint32_t node = 0;
+            uint32_t way = 0;
+            for (int i = log2Ways - 1; i >= 0; --i) {
+                uint32_t bit = (meta >> node) & 1;
+                way |= bit << i;
+                node = node * 2 + 1 + bit;
+            }
+            return way;
+        }
+        case Replacement::LRU: {
+            uint32_t way = 0;
+            for (uint32_t i = 1; i < ways; ++i) {
+                if (field(i) > field(way)) {
+                    way = i;
+                }
+            }
+            return way;
+        }
+        case Replacement::SRRIP: {
+            uint32_t oldest = 0;
+            for (uint32_t i = 0; i < ways; ++i) {
+                oldest = std::max(oldest, field(i));
+            }
+            for (uint32_t i = 0; i < ways; ++i) {
+                if (((field(i) + 3 - oldest) & fieldMask) == 3) {
+                    return i;
+                }
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// getData in GenericCache.bsv
+CacheModel::Result CacheModel::access(uint32_t line, bool write) {
+    uint32_t bank = line & ((1u << log2Banks) - 1);
+    uint32_t set = (line >> log2Banks) & ((1u << log2Sets) - 1);
+    uint32_t tag = line >> (log2Banks + log2Sets);
+    uint32_t setIndex = (bank << log2Sets) | set;
+    uint32_t base = setIndex << log2Ways;
+    uint32_t ways = 1u << log2Ways;
+    Result result = {true, false, 0};
+
+    for (uint32_t way = 0; way < ways; ++way) {
+        if (states[base + way] != Invalid && tags[base + way] == tag) {
+            if (write) {
+                states[base + way] = Dirty;
+            }
+            metadata[setIndex] = touch(metadata[setIndex], way, true, false);
+            return result;
+        }
+    }
+
+    ++misses;
+    result.hit = false;
+    uint32_t way = 0;
+    while (way < ways && states[base + way] != Invalid) {
+        ++way;
+    }
+    bool replaced = way == ways;
+    if (replaced) {
+        way = victim(metadata[setIndex]);
+        if (states[base + way] == Dirty) {
+            result.writeback = true;
+            result.victimLine = (tags[base + way] << (log2Banks + log2Sets)) | (set << log2Banks) | bank;
+        }
+    }
+    tags[base + way] = tag;
+    states[base + way] = write ? Dirty : Clean;
+    metadata[setIndex] = touch(metadata[setIndex], way, false, replaced);
+    return result;
+}
+
+// the layout of extractSpecificCache in glue.cpp: the sets of bank 0, then bank 1, ...
+json CacheModel::save(const std::vector<uint8_t> &memory) const {
+    json cache;
+    uint32_t ways = 1u << log2Ways;
+    cache["set"] = 1 << log2Sets;
+    cache["way"] = ways;
+    cache["bank"] = 1 << log2Banks;
+
+    for (uint32_t bank = 0; bank < (1u << log2Banks); ++bank)
+    for (uint32_t set = 0; set < (1u << log2Sets); ++set) {
+        uint32_t setIndex = (bank << log2Sets) | set;
+        json setState;
+        setState["lru"] = metadata[setIndex];
+        for (uint32_t way = 0; way < ways; ++way) {
+            uint32_t index = (setIndex << log2Ways) | way;
+            json lineState;
+            lineState["valid"] = states[index] != Invalid;
+            lineState["dirty"] = states[index] == Dirty;
+            lineState["tag"] = tags[index];
+
+            // word i of the line in bits [32i+31:32i], as the memory; zero when invalid
+            uint64_t data[8] = {0};
+            if (states[index] != Invalid) {
+                uint64_t line = ((uint64_t)tags[index] << (log2Banks + log2Sets)) | (set << log2Banks) | bank;
+                memcpy(data, memory.data() + ((line * MAIN_MEM_LINE_BYTES) & (memory.size() - 1)), sizeof(data));
+            }
+            for (int i = 0; i < 8; ++i) {
+                lineState["data"].emplace_back(data[i]);
+            }
+            setState["lines"].emplace_back(lineState);
+        }
+        cache["data"].emplace_back(setState);
+    }
+    return cache;
+}
+
+CacheHierarchy::CacheHierarchy(int cores, Replacement l2Policy)
+    : l1i(cores, CacheModel(L1I_SET_COUNT_LOG2, L1I_WAY_LOG2, 0, Replacement::PLRU)),
+      l1d(cores, CacheModel(L1D_SET_COUNT_LOG2, L1D_WAY_LOG2, 0, Replacement::PLRU)),
+      l2(L2_SET_COUNT_LOG2, L2_WAY_LOG2, L2_BANK_LOG2, l2Policy),
+      lastFetch(cores, UINT32_MAX), lastData(cores, UINT32_MAX), lastDirty(cores, false) {}
+
+void CacheHierarchy::instruction(int core, uint32_t line) {
+    if (!l1i[core].access(line, false).hit) {
+        l2.access(line, false);
+    }
+}
+
+void CacheHierarchy::dataAccess(int core, uint32_t line, bool write) {
+    CacheModel::Result result = l1d[core].access(line, write);
+    if (!result.hit) {
+        l2.access(line, false);
+        if (result.writeback) {
+            l2.access(result.victimLine, true);
+        }
+    }
+}
+
+void CacheHierarchy::saveCore(json &state, int core, const std::vector<uint8_t> &memory) const {
+    state["L1i"] = l1i[core].save(memory);
+    if (l1d.size() == 1) {
+        state["L1d"] = l1d[core].save(memory);
+    }
+}
+
+json CacheHierarchy::saveL2(const std::vector<uint8_t> &memory) const {
+    return l2.save(memory);
+}
+
+void CacheHierarchy::printStats(FILE *out) const {
+    uint64_t l1iMisses = 0;
+    uint64_t l1dMisses = 0;
+    for (size_t core = 0; core < l1i.size(); ++core) {
+        l1iMisses += l1i[core].misses;
+        l1dMisses += l1d[core].misses;
+    }
+    fprintf(out, "funcsim: cache warming misses: L1i %lu, L1d %lu, L2 %lu\n", l1iMisses, l1dMisses, l2.misses);
+}
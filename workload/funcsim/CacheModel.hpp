@@ -0,0 +1,113 @@
+// Functional model of the cache hierarchy of CacheInterface.bsv, to warm the caches
+// while fast-forwarding.
+//
+// Each cache follows mkGenericCache: the same set, way and tag split of the line
+// address, a hit touches the replacement metadata of its set, a miss takes the first
+// invalid way or the victim of the policy, and a store allocates and dirties the line.
+// A dirty L1d victim is written back into the L2 after the fill of the new line, as
+// when the victim buffer has room. Only the tags, states and metadata are kept: the
+// snapshot takes the data of every line from memory, which holds the latest values.
+//
+// Not modelled: the prefetchers (off after reset), wrong-path fetches, the order of
+// the L1i and L1d requests at the L2 within a cycle, a line taken back from a victim
+// buffer, and the coherence of the L1ds of a multi-core build.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../../json.hpp"
+
+// the policies of Replacement.bsv that do not depend on an LFSR
+enum class Replacement { PLRU, LRU, SRRIP };
+
+bool parseReplacement(const std::string &name, Replacement &policy);
+
+class CacheModel {
+public:
+    // sets per bank, as the parameters of extractSpecificCache in glue.cpp
+    CacheModel(int log2Sets, int log2Ways, int log2Banks, Replacement policy);
+
+    struct Result {
+        bool hit;
+        bool writeback;         // a dirty line was evicted
+        uint32_t victimLine;
+    };
+
+    // line address (byte address / 64); write dirties the line
+    Result access(uint32_t line, bool write);
+
+    // the section of a host snapshot, the data comes from memory
+    nlohmann::json save(const std::vector<uint8_t> &memory) const;
+
+    uint64_t misses = 0;
+
+private:
+    enum State : uint8_t { Invalid, Clean, Dirty };
+
+    uint32_t touch(uint32_t meta, uint32_t way, bool hit, bool replaced) const;
+    uint32_t victim(uint32_t meta) const;
+
+    int log2Sets;
+    int log2Ways;
+    int log2Banks;
+    int fieldBits;
+    Replacement policy;
+    // indexed by (bank << log2Sets | set) << log2Ways | way
+    std::vector<uint32_t> tags;
+    std::vector<uint8_t> states;
+    // per bank and set
+    std::vector<uint32_t> metadata;
+};
+
+// The L1i and L1d of every core and the shared L2
+class CacheHierarchy {
+public:
+    CacheHierarchy(int cores, Replacement l2Policy);
+
+    // A fetch of the instruction at pc, the word after it too for a 32-bit instruction
+    // at the end of a line. Accesses to the line of the previous access of the same L1
+    // change nothing (pseudo-LRU), except a store to a clean line.
+    void fetch(int core, uint32_t pc, uint32_t length) {
+        uint32_t line = pc >> 6;
+        if (line != lastFetch[core]) {
+            lastFetch[core] = line;
+            instruction(core, line);
+        }
+        if (length == 4 && (pc & 63) == 62) {
+            lastFetch[core] = line + 1;
+            instruction(core, line + 1);
+        }
+    }
+
+    void data(int core, uint32_t addr, bool write) {
+        uint32_t line = addr >> 6;
+        if (line != lastData[core] || (write && !lastDirty[core])) {
+            lastData[core] = line;
+            lastDirty[core] = write;
+            dataAccess(core, line, write);
+        }
+    }
+
+    // "L1i" and "L1d" of a core. The L1ds of a multi-core build need the directory
+    // (loadDirectory in glue.cpp), which is not modelled: they are left out there.
+    void saveCore(nlohmann::json &state, int core, const std::vector<uint8_t> &memory) const;
+    nlohmann::json saveL2(const std::vector<uint8_t> &memory) const;
+
+    void printStats(FILE *out) const;
+
+private:
+    void instruction(int core, uint32_t line);
+    void dataAccess(int core, uint32_t line, bool write);
+
+    std::vector<CacheModel> l1i;
+    std::vector<CacheModel> l1d;
+    CacheModel l2;
+    std::vector<uint32_t> lastFetch;
+    std::vector<uint32_t> lastData;
+    std::vector<bool> lastDirty;
+};
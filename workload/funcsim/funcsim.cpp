@@ -0,0 +1,511 @@
+// Functional RV32IMC simulator, to fast-forward a workload to the region of interest
+// and hand it to the hardware as a snapshot.
+//
+// It starts from an ELF file (at PC 0, as the hardware does after reset) or from a
+// snapshot written by the host, runs the instructions of each core without timing,
+// and writes a snapshot that the `l` command of the host loads: the PC and the
+// registers of every core, and the main memory in <snapshot>.mem. With -w the fetches
+// and the memory accesses also go through a model of the caches (CacheModel.hpp)
+// and the snapshot has warm caches, otherwise the caches start empty.
+//
+// The instructions are decoded once per halfword address and dispatched with computed
+// gotos; a store to a decoded address drops the decoded instruction. The memory wraps
+// at its size like the BRAM, and the MMIO addresses of mmio.c behave as in Core.bsv:
+// putchar, print of an integer, exit, the hart id, the cycle counter (always 0), and
+// waitForSnapshot, which stops the simulation with -p and otherwise resumes right away.
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../elf2hex/ElfFile.hpp"
+#include "CacheModel.hpp"
+#include "../../RVDecode.hpp"
+#include "../../json.hpp"
+
+using json = nlohmann::json;
+
+struct Hart {
+    uint32_t pc = 0;
+    uint32_t x[33] = {0};
+    uint64_t instret = 0;
+};
+
+enum class Stop { Budget, Exit, Marker };
+
+static const uint32_t MMIO_PUT = 0xF000FFF0;
+static const uint32_t MMIO_PRINT = 0xF000FFF4;
+static const uint32_t MMIO_FINISH = 0xF000FFF8;
+static const uint32_t MMIO_WAIT = 0xF000FFFC;
+static const uint32_t MMIO_HART = 0xF000FFEC;
+static const uint32_t MMIO_CYCLES = 0xF000FFE8;
+static const uint64_t LINE_BYTES = 64;
+
+class Machine {
+public:
+    std::vector<uint8_t> memory;
+    uint32_t mask;
+    std::vector<Decoded> decoded;
+    std::vector<Hart> harts;
+    bool stopAtMarker = false;
+    int exitCode = 0;
+    // the accesses of run<true> go there
+    CacheHierarchy *caches = nullptr;
+
+    Machine(uint64_t bytes, int cores) : memory(bytes, 0), mask(bytes - 1), decoded(bytes / 2), harts(cores) {}
+
+    void write(uint32_t addr, const void *data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            memory[(addr + i) & mask] = ((const uint8_t *)data)[i];
+        }
+        invalidate(addr, size);
+    }
+
+    // a 32-bit instruction may start in the halfword before the address
+    void invalidate(uint32_t addr, size_t size) {
+        uint32_t first = (addr & ~1u) - 2;
+        uint32_t count = (addr + size - 1 - first) / 2 + 1;
+        for (uint32_t i = 0; i < count; ++i) {
+            decoded[((first + 2 * i) & mask) >> 1].op = OP_DECODE;
+        }
+    }
+
+    template <bool warm>
+    Stop run(int id, uint64_t budget, uint64_t &executed);
+
+private:
+    // there is no timing: the cycle counter reads 0
+    uint32_t mmioLoad(int id, uint32_t addr) {
+        return addr == MMIO_HART ? id : 0;
+    }
+
+    // returns true when the simulation stops
+    bool mmioStore(Hart &hart, uint32_t addr, uint32_t data, Stop &stop) {
+        switch (addr) {
+            case MMIO_PUT:
+                putchar(data & 0xFF);
+                return false;
+            case MMIO_PRINT:
+                fprintf(stderr, "%d", (int)data);
+                return false;
+            case MMIO_FINISH:
+                exitCode = data;
+                if (data == 0) {
+                    fprintf(stderr, " \033[0;32mPASS\033[0m\n");
+                } else {
+                    fprintf(stderr, " \033[0;31mFAIL\033[0m (%0d)\n", (int)data);
+                }
+                stop = Stop::Exit;
+                return true;
+            case MMIO_WAIT:
+                // waitForSnapshot spins until x10 is 1, as the host sets it after the snapshot
+                hart.x[10] = 1;
+                if (stopAtMarker) {
+                    stop = Stop::Marker;
+                }
+                return stopAtMarker;
+            default:
+                return false;
+        }
+    }
+
+    static bool isMMIO(uint32_t addr) {
+        return addr == MMIO_PUT || addr == MMIO_PRINT || addr == MMIO_FINISH || addr == MMIO_WAIT || addr == MMIO_HART || addr == MMIO_CYCLES;
+    }
+};
+
+// Runs up to budget instructions of a hart, through the caches if warm.
+template <bool warm>
+Stop Machine::run(int id, uint64_t budget, uint64_t &executed) {
+    static const void *labels[OP_COUNT] = {
+        &&op_decode, &&op_illegal, &&op_nop,
+        &&op_lui, &&op_auipc, &&op_jal, &&op_jalr,
+        &&op_beq, &&op_bne, &&op_blt, &&op_bge, &&op_bltu, &&op_bgeu,
+        &&op_lb, &&op_lh, &&op_lw, &&op_lbu, &&op_lhu, &&op_sb, &&op_sh, &&op_sw,
+        &&op_addi, &&op_slti, &&op_sltiu, &&op_xori, &&op_ori, &&op_andi, &&op_slli, &&op_srli, &&op_srai,
+        &&op_add, &&op_sub, &&op_sll, &&op_slt, &&op_sltu, &&op_xor, &&op_srl, &&op_sra, &&op_or, &&op_and,
+        &&op_mul, &&op_mulh, &&op_mulhsu, &&op_mulhu, &&op_div, &&op_divu, &&op_rem, &&op_remu,
+    };
+
+    Hart &hart = harts[id];
+    uint32_t *x = hart.x;
+    uint32_t pc = hart.pc;
+    uint8_t *mem = memory.data();
+    uint64_t left = budget;
+    Stop stop = Stop::Budget;
+    const Decoded *d;
+    uint32_t addr, value;
+
+#define RS1 x[d->rs1]
+#define RS2 x[d->rs2]
+#define RD x[d->rd]
+#define NEXT() do { pc += d->length; goto dispatch; } while (0)
+#define BRANCH(condition) do { pc += (condition) ? d->imm : d->length; goto dispatch; } while (0)
+// The memory is accessed as in the hardware: the aligned word, with the data shifted by
+// the offset of the address in it (only the bytes inside the word for a misaligned one).
+#define LOAD(type) do { \
+        addr = RS1 + d->imm; \
+        if ((addr >> 28) == 0xF && isMMIO(addr)) { RD = (type)mmioLoad(id, addr); NEXT(); } \
+        if (warm) caches->data(id, addr, false); \
+        uint32_t word; \
+        memcpy(&word, mem + (addr & mask & ~3u), 4); \
+        RD = (int32_t)(type)(word >> ((addr & 3) * 8)); \
+        NEXT(); \
+    } while (0)
+#define STORE(type) do { \
+        addr = RS1 + d->imm; \
+        value = RS2; \
+        if ((addr >> 28) == 0xF && isMMIO(addr)) { \
+            pc += d->length; \
+            if (mmioStore(hart, addr, value << ((addr & 3) * 8), stop)) goto done; \
+            goto dispatch; \
+        } \
+        if (warm) caches->data(id, addr, true); \
+        if ((addr & (sizeof(type) - 1)) == 0) { \
+            type stored = (type)value; \
+            memcpy(mem + (addr & mask), &stored, sizeof(type)); \
+        } else { \
+            for (uint32_t b = addr & 3; b < 4 && b < (addr & 3) + sizeof(type); ++b) \
+                mem[((addr & ~3u) + b) & mask] = value >> ((b - (addr & 3)) * 8); \
+        } \
+        invalidate(addr & mask, sizeof(type)); \
+        NEXT(); \
+    } while (0)
+
+dispatch:
+    if (left == 0) {
+        goto done;
+    }
+    --left;
+    pc &= mask;
+    d = &decoded[pc >> 1];
+fetched:
+    if (warm) caches->fetch(id, pc, d->length);
+    goto *labels[d->op];
+
+op_decode: {
+        uint16_t low, high;
+        memcpy(&low, mem + pc, 2);
+        memcpy(&high, mem + ((pc + 2) & mask), 2);
+        Decoded fresh = (low & 3) != 3 ? decode(expandCompressed(low), 2) : decode(low | ((uint32_t)high << 16), 4);
+        decoded[pc >> 1] = fresh;
+        goto fetched;
+    }
+op_illegal:
+    // the hardware redirects the fetch to 0
+    fprintf(stderr, "funcsim: core %d: illegal instruction at 0x%08x, continuing at 0\n", id, pc);
+    pc = 0;
+    goto dispatch;
+op_nop: NEXT();
+op_lui: RD = d->imm; NEXT();
+op_auipc: RD = pc + d->imm; NEXT();
+op_jal: RD = pc + d->length; pc += d->imm; goto dispatch;
+op_jalr: value = (RS1 + d->imm) & ~1u; RD = pc + d->length; pc = value; goto dispatch;
+op_beq: BRANCH(RS1 == RS2);
+op_bne: BRANCH(RS1 != RS2);
+op_blt: BRANCH((int32_t)RS1 < (int32_t)RS2);
+op_bge: BRANCH((int32_t)RS1 >= (int32_t)RS2);
+op_bltu: BRANCH(RS1 < RS2);
+op_bgeu: BRANCH(RS1 >= RS2);
+op_lb: LOAD(int8_t);
+op_lh: LOAD(int16_t);
+op_lw: LOAD(int32_t);
+op_lbu: LOAD(uint8_t);
+op_lhu: LOAD(uint16_t);
+op_sb: STORE(uint8_t);
+op_sh: STORE(uint16_t);
+op_sw: STORE(uint32_t);
+op_addi: RD = RS1 + d->imm; NEXT();
+op_slti: RD = (int32_t)RS1 < (int32_t)d->imm; NEXT();
+op_sltiu: RD = RS1 < d->imm; NEXT();
+op_xori: RD = RS1 ^ d->imm; NEXT();
+op_ori: RD = RS1 | d->imm; NEXT();
+op_andi: RD = RS1 & d->imm; NEXT();
+op_slli: RD = RS1 << d->imm; NEXT();
+op_srli: RD = RS1 >> d->imm; NEXT();
+op_srai: RD = (int32_t)RS1 >> d->imm; NEXT();
+op_add: RD = RS1 + RS2; NEXT();
+op_sub: RD = RS1 - RS2; NEXT();
+op_sll: RD = RS1 << (RS2 & 31); NEXT();
+op_slt: RD = (int32_t)RS1 < (int32_t)RS2; NEXT();
+op_sltu: RD = RS1 < RS2; NEXT();
+op_xor: RD = RS1 ^ RS2; NEXT();
+op_srl: RD = RS1 >> (RS2 & 31); NEXT();
+op_sra: RD = (int32_t)RS1 >> (RS2 & 31); NEXT();
+op_or: RD = RS1 | RS2; NEXT();
+op_and: RD = RS1 & RS2; NEXT();
+op_mul: RD = RS1 * RS2; NEXT();
+op_mulh: RD = ((int64_t)(int32_t)RS1 * (int64_t)(int32_t)RS2) >> 32; NEXT();
+op_mulhsu: RD = ((int64_t)(int32_t)RS1 * (int64_t)(uint64_t)RS2) >> 32; NEXT();
+op_mulhu: RD = ((uint64_t)RS1 * (uint64_t)RS2) >> 32; NEXT();
+op_div:
+    if (RS2 == 0) RD = ~0u;
+    else if (RS1 == 0x80000000 && RS2 == ~0u) RD = RS1;
+    else RD = (int32_t)RS1 / (int32_t)RS2;
+    NEXT();
+op_divu: RD = RS2 == 0 ? ~0u : RS1 / RS2; NEXT();
+op_rem:
+    if (RS2 == 0) RD = RS1;
+    else if (RS1 == 0x80000000 && RS2 == ~0u) RD = 0;
+    else RD = (int32_t)RS1 % (int32_t)RS2;
+    NEXT();
+op_remu: RD = RS2 == 0 ? RS1 : RS1 % RS2; NEXT();
+
+done:
+#undef RS1
+#undef RS2
+#undef RD
+#undef NEXT
+#undef BRANCH
+#undef LOAD
+#undef STORE
+    hart.pc = pc & mask;
+    x[32] = 0;
+    executed = budget - left;
+    hart.instret += executed;
+    return stop;
+}
+
+struct Options {
+    std::string elf;
+    std::string input;
+    std::string output;
+    uint64_t instructions = 0;
+    uint64_t quantum = 10000;
+    uint64_t memoryMB = 4;
+    int cores = 1;
+    bool stopAtMarker = false;
+    bool verbose = false;
+    bool warm = false;
+    uint64_t warmFrom = 0;
+    Replacement l2Replacement = Replacement::PLRU;
+};
+
+static Options options;
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options] [elf-file]" << std::endl;
+    std::cerr << "Runs a workload without timing and saves a snapshot for the host to load" << std::endl;
+    std::cerr << "  elf-file          program loaded into memory, the cores start at PC 0" << std::endl;
+    std::cerr << "  -s <snapshot>     start from a snapshot of the host instead" << std::endl;
+    std::cerr << "  -o <snapshot>     write a snapshot when the simulation stops, memory in <snapshot>.mem" << std::endl;
+    std::cerr << "  -n <instructions> stop after this many instructions of core 0 (default: until exit)" << std::endl;
+    std::cerr << "  -p                stop at waitForSnapshot, which then resumes when the snapshot is loaded" << std::endl;
+    std::cerr << "  -c <cores>        cores, as CORES of the build (default 1 or the cores of the snapshot)" << std::endl;
+    std::cerr << "  -q <instructions> instructions a core runs before the next one (default 10000)" << std::endl;
+    std::cerr << "  -m <MB>           memory size, a power of two: 4 for the BRAM, MAIN_MEM_MB with DMA_MAINMEM (default 4)" << std::endl;
+    std::cerr << "  -w <instructions> warm the caches from this instruction of core 0 on, and save them" << std::endl;
+    std::cerr << "  -r <policy>       replacement policy of the L2, as L2_REPLACEMENT of the build: PLRU, LRU or SRRIP (default PLRU)" << std::endl;
+    std::cerr << "  -v                print the instruction count and the speed" << std::endl;
+}
+
+static void loadElf(Machine &machine, const std::string &path) {
+    ElfFile elf;
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back(0);
+    if (!elf.open(name.data())) {
+        std::cerr << "ERROR: cannot load " << path << std::endl;
+        exit(1);
+    }
+    for (const auto &section : elf.getSections()) {
+        machine.write(section.base, section.data, section.data_size);
+    }
+}
+
+static void loadCoreState(Hart &hart, const json &state) {
+    hart.pc = state["PC"].get<uint32_t>();
+    for (int i = 1; i < 32; ++i) {
+        hart.x[i] = state["RegisterFile"][i - 1].get<uint32_t>();
+    }
+}
+
+// MainMemFile is relative to the directory of the snapshot, as in glue.cpp; older
+// snapshots hold the path as written, relative to the working directory of the save
+static std::string mainMemFilePath(const json &snapshot, const std::string &path) {
+    std::string memPath = snapshot["MainMemFile"];
+    size_t slash = path.rfind('/');
+    if (memPath.empty() || memPath[0] == '/' || slash == std::string::npos) {
+        return memPath;
+    }
+    std::string resolved = path.substr(0, slash + 1) + memPath;
+    return access(resolved.c_str(), R_OK) == 0 || access(memPath.c_str(), R_OK) != 0 ? resolved : memPath;
+}
+
+// the layouts of importSnapshot in glue.cpp, the caches are ignored
+static void loadSnapshot(Machine &machine, const json &snapshot, const std::string &path) {
+    if (snapshot.contains("Cores")) {
+        for (size_t core = 0; core < snapshot["Cores"].size() && core < machine.harts.size(); ++core) {
+            loadCoreState(machine.harts[core], snapshot["Cores"][core]);
+        }
+    } else {
+        loadCoreState(machine.harts[0], snapshot);
+    }
+
+    uint64_t line[8];
+    if (snapshot.contains("MainMemFile")) {
+        std::string memPath = mainMemFilePath(snapshot, path);
+        FILE *memFile = fopen(memPath.c_str(), "rb");
+        if (memFile == NULL) {
+            std::cerr << "ERROR: cannot read " << memPath << std::endl;
+            exit(1);
+        }
+        for (uint64_t i = 0; i < machine.memory.size() / LINE_BYTES && fread(line, LINE_BYTES, 1, memFile) == 1; ++i) {
+            machine.write(i * LINE_BYTES, line, LINE_BYTES);
+        }
+        fclose(memFile);
+    } else {
+        const json &lines = snapshot["MainMem"];
+        for (uint64_t i = 0; i < lines.size() && i < machine.memory.size() / LINE_BYTES; ++i) {
+            for (int j = 0; j < 8; ++j) {
+                line[j] = lines[i][j];
+            }
+            machine.write(i * LINE_BYTES, line, LINE_BYTES);
+        }
+    }
+}
+
+static void saveSnapshot(const Machine &machine, const std::string &path) {
+    json snapshot;
+    for (size_t core = 0; core < machine.harts.size(); ++core) {
+        const Hart &hart = machine.harts[core];
+        json state;
+        state["PC"] = hart.pc;
+        for (int i = 1; i < 32; ++i) {
+            state["RegisterFile"].emplace_back(hart.x[i]);
+        }
+        if (machine.caches != nullptr) {
+            machine.caches->saveCore(state, core, machine.memory);
+        }
+        if (machine.harts.size() == 1) {
+            snapshot = state;
+        } else {
+            snapshot["Cores"].emplace_back(state);
+        }
+    }
+
+    std::string memPath = path + ".mem";
+    FILE *memFile = fopen(memPath.c_str(), "wb");
+    if (memFile == NULL || fwrite(machine.memory.data(), 1, machine.memory.size(), memFile) != machine.memory.size()) {
+        std::cerr << "ERROR: cannot write " << memPath << std::endl;
+        exit(1);
+    }
+    fclose(memFile);
+    size_t slash = path.rfind('/');
+    snapshot["MainMemFile"] = (slash == std::string::npos ? path : path.substr(slash + 1)) + ".mem";
+    snapshot["MainMemLines"] = machine.memory.size() / LINE_BYTES;
+    if (machine.caches != nullptr) {
+        snapshot["L2"] = machine.caches->saveL2(machine.memory);
+    }
+
+    std::ofstream file(path);
+    file << std::setw(4) << snapshot << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "s:o:n:pc:q:m:w:r:vh")) != -1) {
+        switch (opt) {
+            case 's': options.input = optarg; break;
+            case 'o': options.output = optarg; break;
+            case 'n': options.instructions = strtoull(optarg, nullptr, 0); break;
+            case 'p': options.stopAtMarker = true; break;
+            case 'c': options.cores = atoi(optarg); break;
+            case 'q': options.quantum = strtoull(optarg, nullptr, 0); break;
+            case 'm': options.memoryMB = strtoull(optarg, nullptr, 0); break;
+            case 'w': options.warm = true; options.warmFrom = strtoull(optarg, nullptr, 0); break;
+            case 'r':
+                if (!parseReplacement(optarg, options.l2Replacement)) {
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v': options.verbose = true; break;
+            default: printUsage(argv[0]); return 1;
+        }
+    }
+    if (optind < argc) {
+        options.elf = argv[optind++];
+    }
+    uint64_t memoryBytes = options.memoryMB << 20;
+    if (optind != argc || options.elf.empty() == options.input.empty() || options.cores < 1 || options.cores > 32
+        || options.quantum == 0 || memoryBytes == 0 || (memoryBytes & (memoryBytes - 1)) != 0 || memoryBytes > (1ull << 32)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    json snapshot;
+    if (!options.input.empty()) {
+        std::ifstream file(options.input);
+        if (!file) {
+            std::cerr << "ERROR: cannot open " << options.input << std::endl;
+            return 1;
+        }
+        file >> snapshot;
+        if (snapshot.contains("Cores")) {
+            options.cores = std::max<int>(options.cores, snapshot["Cores"].size());
+        }
+    }
+    Machine machine(memoryBytes, options.cores);
+    machine.stopAtMarker = options.stopAtMarker;
+    CacheHierarchy caches(options.cores, options.l2Replacement);
+    if (options.warm) {
+        machine.caches = &caches;
+    }
+    if (options.input.empty()) {
+        loadElf(machine, options.elf);
+    } else {
+        loadSnapshot(machine, snapshot, options.input);
+    }
+
+    // the cores take turns, the limit and the start of the warming count the
+    // instructions of core 0
+    auto start = std::chrono::steady_clock::now();
+    uint64_t total = 0;
+    Stop stop = Stop::Budget;
+    uint64_t limit = options.instructions == 0 ? UINT64_MAX : options.instructions;
+    while (stop == Stop::Budget && machine.harts[0].instret < limit) {
+        bool warming = options.warm && machine.harts[0].instret >= options.warmFrom;
+        for (int core = 0; core < options.cores && stop == Stop::Budget; ++core) {
+            uint64_t budget = options.quantum;
+            if (core == 0) {
+                budget = std::min(budget, limit - machine.harts[0].instret);
+                if (options.warm && !warming) {
+                    budget = std::min(budget, options.warmFrom - machine.harts[0].instret);
+                }
+            }
+            uint64_t executed;
+            Stop result = warming ? machine.run<true>(core, budget, executed) : machine.run<false>(core, budget, executed);
+            total += executed;
+            if (result == Stop::Exit || (result == Stop::Marker && options.stopAtMarker)) {
+                stop = result;
+            }
+        }
+    }
+    fflush(stdout);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (options.verbose) {
+        fprintf(stderr, "funcsim: %lu instructions of core 0, %lu in total, %.1f MIPS, stopped at pc 0x%08x (%s)\n",
+                machine.harts[0].instret, total, total / seconds / 1e6, machine.harts[0].pc,
+                stop == Stop::Exit ? "exit" : stop == Stop::Marker ? "waitForSnapshot" : "instruction limit");
+        if (options.warm) {
+            caches.printStats(stderr);
+        }
+    }
+    if (!options.output.empty()) {
+        if (stop == Stop::Exit) {
+            std::cerr << "The program exited, no snapshot written" << std::endl;
+            return 1;
+        }
+        saveSnapshot(machine, options.output);
+    }
+    return stop == Stop::Exit ? machine.exitCode != 0 : 0;
+}
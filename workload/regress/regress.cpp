@@ -0,0 +1,478 @@
+// Regression and performance runs: runs whole workloads, several simulators at a time,
+// checks that each one passes and writes its counters as a table, which a later run
+// compares against to flag performance regressions.
+//
+// Each job gets its own directory, with the mem.vmh and memlines.vmh of its workload
+// (test/build/<workload>.hex, as test.sh makes them), and starts its own simulator (the
+// ubuntu.exe of a Connectal build) there. The simulator runs the program with `wd` and
+// a window longer than any workload, so that it prints the counters of the whole run as
+// "window <counter> <value>" once the program exits; the exit itself is the PASS or
+// FAIL of the MMIO output.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../Spawn.hpp"
+
+// the rv32i build of the basic tests, when no workload is given
+static const char *defaultWorkloads[] = {
+    "add32", "and32", "or32", "sub32", "xor32", "hello32", "mul32", "reverse32", "thelie32", "thuemorse32", "matmul32"};
+
+// the window of a whole run, longer than any workload
+static const uint64_t wholeRun = 1ull << 62;
+
+struct Job {
+    size_t index;
+    std::string workload;
+};
+
+struct Result {
+    // PASS, FAIL and the exit code of the program, if it exited
+    bool exited = false;
+    bool passed = false;
+    int exitCode = 0;
+    double seconds = 0;
+    std::string error;
+    // in the order the simulator prints them
+    std::vector<std::pair<std::string, uint64_t>> counters;
+
+    bool ok() const {
+        return error.empty() && exited && passed;
+    }
+
+    std::string status() const {
+        if (!error.empty()) {
+            return error;
+        }
+        return !exited ? "no exit" : passed ? "pass" : "fail";
+    }
+
+    uint64_t counter(const std::string &name) const {
+        for (const auto &c : counters) {
+            if (c.first == name) {
+                return c.second;
+            }
+        }
+        return 0;
+    }
+};
+
+struct Options {
+    unsigned workers = 0;
+    unsigned timeout = 60;
+    double threshold = 2;
+    std::string simulator = "../../bluesim/bin/ubuntu.exe";
+    std::string workloadDirectory = "..";
+    std::string directory = "runs";
+    std::string csv = "regress.csv";
+    std::string baseline;
+};
+
+static Options options;
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options] [workload ...]" << std::endl;
+    std::cerr << "Runs each workload to its end, checks PASS or FAIL and writes its counters" << std::endl;
+    std::cerr << "  workload          name of test/build/<workload>.hex, e.g. add32 or mem_stream32m" << std::endl;
+    std::cerr << "                      (default: the rv32i build of add, and, or, sub, xor, hello, mul," << std::endl;
+    std::cerr << "                      reverse, thelie, thuemorse and matmul)" << std::endl;
+    std::cerr << "  -j <workers>      simulators run at a time (default: the number of cores)" << std::endl;
+    std::cerr << "  -s <simulator>    the simulator binary (default ../../bluesim/bin/ubuntu.exe)" << std::endl;
+    std::cerr << "  -w <directory>    the workload directory, with test/build and tools (default ..)" << std::endl;
+    std::cerr << "  -d <directory>    where each workload gets its own directory (default runs)" << std::endl;
+    std::cerr << "  -t <seconds>      kill a simulator that runs longer, 0 for no limit (default 60)" << std::endl;
+    std::cerr << "  -o <file>         results as CSV (default regress.csv)" << std::endl;
+    std::cerr << "  -b <file>         CSV of an earlier run to compare the cycles against" << std::endl;
+    std::cerr << "  -r <percent>      cycles above the baseline by more than this are a regression (default 2)" << std::endl;
+}
+
+// the jobs run in other directories, so every path is made absolute first
+static std::string absolutePath(const std::string &path) {
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) == nullptr) {
+        std::cerr << "ERROR: " << path << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    return resolved;
+}
+
+// test.sh in the directory of the job: mem.vmh is the hex without its last line, and
+// arrange_mem.py makes memlines.vmh from it
+static bool prepareJob(const Job &job, const std::string &directory, std::ofstream &log, std::string &error) {
+    std::string hexPath = options.workloadDirectory + "/test/build/" + job.workload + ".hex";
+    std::ifstream hex(hexPath);
+    if (!hex) {
+        error = "no " + job.workload + ".hex";
+        return false;
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(hex, line)) {
+        lines.push_back(line);
+    }
+    if (!lines.empty()) {
+        lines.pop_back();
+    }
+    std::ofstream vmh(directory + "/mem.vmh");
+    for (const auto &l : lines) {
+        vmh << l << "\n";
+    }
+    vmh.close();
+    if (!vmh) {
+        error = "cannot write mem.vmh";
+        return false;
+    }
+    SpawnRequest request;
+    request.argv = {"python3", options.workloadDirectory + "/tools/arrange_mem.py"};
+    request.directory = directory;
+    request.mergeStderr = true;
+    SpawnResult spawned = spawnWithTimeout(request, [&](const std::string &line) {
+        log << line << "\n";
+    });
+    if (!spawned.error.empty() || spawned.status != 0) {
+        error = "arrange_mem.py failed";
+        return false;
+    }
+    return true;
+}
+
+// A window line may follow a prompt printed without a newline, so the last "window "
+// of the line is taken.
+static bool parseWindowLine(const std::string &line, std::string &name, uint64_t &value) {
+    size_t start = line.rfind("window ");
+    if (start == std::string::npos) {
+        return false;
+    }
+    std::istringstream fields(line.substr(start + 7));
+    std::string rest;
+    return (fields >> name >> value) && !(fields >> rest);
+}
+
+// requestMMIO in glue.cpp prints the exit of the program in color, which the output of
+// the program itself cannot
+static void parseExit(const std::string &line, Result &result) {
+    static const std::string pass = "\033[0;32mPASS\033[0m";
+    static const std::string fail = "\033[0;31mFAIL\033[0m (";
+    size_t at;
+    if (line.find(pass) != std::string::npos) {
+        result.exited = true;
+        result.passed = true;
+    } else if ((at = line.find(fail)) != std::string::npos) {
+        result.exited = true;
+        result.passed = false;
+        result.exitCode = atoi(line.c_str() + at + fail.size());
+    }
+}
+
+static void parseLine(const std::string &line, Result &result) {
+    parseExit(line, result);
+    std::string name;
+    uint64_t value;
+    if (parseWindowLine(line, name, value) && name != "complete") {
+        result.counters.emplace_back(name, value);
+    }
+}
+
+static void runJob(const Job &job, Result &result) {
+    auto start = std::chrono::steady_clock::now();
+    std::string directory = options.directory + "/" + job.workload;
+    // everything the job prints, for a look at a failure
+    std::ofstream log;
+    if (mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST) {
+        log.open(directory + "/output.log");
+    }
+    if (!log) {
+        result.error = "cannot write " + directory + "/output.log";
+        return;
+    }
+    if (!prepareJob(job, directory, log, result.error)) {
+        return;
+    }
+
+    SpawnRequest request;
+    request.argv = {options.simulator};
+    // the main memory loads the .vmh files of the working directory
+    request.directory = directory;
+    // every simulator needs its own socket between the host and the simulation
+    request.environment = {"BLUESIM_SOCKET_NAME=regress-" + std::to_string(getpid()) + "-" + std::to_string(job.index)};
+    std::ostringstream commands;
+    commands << "wd\n" << 0 << " " << wholeRun << "\n"
+             << "q\n";
+    request.input = commands.str();
+    // PASS and FAIL go to stderr, the counters to stdout
+    request.mergeStderr = true;
+    request.timeout = options.timeout;
+
+    SpawnResult spawned = spawnWithTimeout(request, [&](const std::string &line) {
+        log << line << "\n";
+        parseLine(line, result);
+    });
+    log.close();
+
+    if (spawned.timedOut) {
+        result.error = "timed out";
+    } else if (!spawned.error.empty()) {
+        result.error = spawned.error;
+    } else if (spawned.status != 0) {
+        result.error = "simulator exited with status " + std::to_string(spawned.status);
+    } else if (!log) {
+        result.error = "cannot write " + directory + "/output.log";
+    }
+    if (result.error.empty() && result.exited && result.counter("instret") == 0) {
+        result.error = "no counters in the simulator output";
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The caches count their misses but not their hits: the L1i misses are per instruction
+// fetched, the L1d misses per thousand instructions, and the L2 misses per request.
+struct Rates {
+    double ipc = 0;
+    double l1iMissRate = 0;
+    double l1dMpki = 0;
+    double l2MissRate = 0;
+};
+
+static Rates rates(const Result &result) {
+    Rates r;
+    uint64_t cycles = result.counter("cycles");
+    uint64_t instret = result.counter("instret");
+    uint64_t l2Requests = result.counter("l2_req_instr") + result.counter("l2_req_data");
+    if (cycles != 0) {
+        r.ipc = (double)instret / cycles;
+    }
+    if (instret != 0) {
+        r.l1iMissRate = (double)result.counter("l1i_miss") / instret;
+        r.l1dMpki = 1000.0 * result.counter("l1d_miss") / instret;
+    }
+    if (l2Requests != 0) {
+        r.l2MissRate = (double)result.counter("l2_miss") / l2Requests;
+    }
+    return r;
+}
+
+static void writeCsv(const std::vector<Job> &jobs, const std::vector<Result> &results) {
+    std::ofstream csv(options.csv);
+    if (!csv) {
+        std::cerr << "ERROR: cannot write " << options.csv << std::endl;
+        return;
+    }
+    // the counters of the first job that printed them, the others print the same ones
+    std::vector<std::string> names;
+    for (const auto &result : results) {
+        if (!result.counters.empty()) {
+            for (const auto &c : result.counters) {
+                names.push_back(c.first);
+            }
+            break;
+        }
+    }
+    csv << "workload,status,exit_code,seconds,ipc,l1i_miss_rate,l1d_mpki,l2_miss_rate";
+    for (const auto &name : names) {
+        csv << "," << name;
+    }
+    csv << std::endl;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const Result &result = results[i];
+        csv << jobs[i].workload << "," << result.status() << "," << result.exitCode << ","
+            << std::fixed << std::setprecision(1) << result.seconds << std::defaultfloat << std::setprecision(6);
+        Rates r = rates(result);
+        if (!result.counters.empty()) {
+            csv << "," << r.ipc << "," << r.l1iMissRate << "," << r.l1dMpki << "," << r.l2MissRate;
+        } else {
+            csv << ",,,,";
+        }
+        for (const auto &name : names) {
+            csv << ",";
+            if (!result.counters.empty()) {
+                csv << result.counter(name);
+            }
+        }
+        csv << std::endl;
+    }
+}
+
+// The rows of a CSV written by writeCsv, by workload, each a map from column to value
+static std::map<std::string, std::map<std::string, std::string>> readCsv(const std::string &path) {
+    std::map<std::string, std::map<std::string, std::string>> rows;
+    std::ifstream csv(path);
+    if (!csv) {
+        std::cerr << "ERROR: cannot open " << path << std::endl;
+        exit(1);
+    }
+    auto split = [](const std::string &line) {
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ',')) {
+            fields.push_back(field);
+        }
+        return fields;
+    };
+    std::string line;
+    if (!std::getline(csv, line)) {
+        return rows;
+    }
+    std::vector<std::string> header = split(line);
+    while (std::getline(csv, line)) {
+        std::vector<std::string> fields = split(line);
+        if (fields.empty()) {
+            continue;
+        }
+        auto &row = rows[fields[0]];
+        for (size_t i = 0; i < fields.size() && i < header.size(); ++i) {
+            row[header[i]] = fields[i];
+        }
+    }
+    return rows;
+}
+
+// A workload regresses if it passed in the baseline and does not pass now, or if its
+// cycles grow by more than the threshold. The instructions must be the same for the
+// cycles to compare: a different instret means a different program or a bug.
+static bool compareBaseline(const std::vector<Job> &jobs, const std::vector<Result> &results) {
+    auto baseline = readCsv(options.baseline);
+    bool regressed = false;
+    std::cout << "against " << options.baseline << ", threshold " << options.threshold << "%" << std::endl;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const Result &result = results[i];
+        auto row = baseline.find(jobs[i].workload);
+        std::cout << std::left << std::setw(24) << jobs[i].workload << std::right;
+        if (row == baseline.end()) {
+            std::cout << "not in the baseline" << std::endl;
+            continue;
+        }
+        auto &before = row->second;
+        if (before["status"] != "pass") {
+            std::cout << "did not pass in the baseline (" << before["status"] << "), now " << result.status() << std::endl;
+            continue;
+        }
+        if (!result.ok()) {
+            std::cout << "REGRESSION: " << result.status() << std::endl;
+            regressed = true;
+            continue;
+        }
+        uint64_t cyclesBefore = strtoull(before["cycles"].c_str(), nullptr, 0);
+        uint64_t instretBefore = strtoull(before["instret"].c_str(), nullptr, 0);
+        uint64_t cycles = result.counter("cycles");
+        if (result.counter("instret") != instretBefore) {
+            std::cout << "instret " << instretBefore << " -> " << result.counter("instret") << ", not comparable" << std::endl;
+            continue;
+        }
+        double change = cyclesBefore == 0 ? 0 : 100.0 * ((double)cycles - cyclesBefore) / cyclesBefore;
+        std::cout << "cycles " << cyclesBefore << " -> " << cycles << " (" << std::showpos << std::fixed
+                  << std::setprecision(2) << change << "%)" << std::noshowpos << std::defaultfloat << std::setprecision(6);
+        if (change > options.threshold) {
+            std::cout << " REGRESSION";
+            regressed = true;
+        } else if (change < -options.threshold) {
+            std::cout << " faster";
+        }
+        std::cout << std::endl;
+    }
+    return regressed;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "j:s:w:d:t:o:b:r:h")) != -1) {
+        switch (opt) {
+            case 'j': options.workers = strtoul(optarg, nullptr, 0); break;
+            case 's': options.simulator = optarg; break;
+            case 'w': options.workloadDirectory = optarg; break;
+            case 'd': options.directory = optarg; break;
+            case 't': options.timeout = strtoul(optarg, nullptr, 0); break;
+            case 'o': options.csv = optarg; break;
+            case 'b': options.baseline = optarg; break;
+            case 'r': options.threshold = atof(optarg); break;
+            default: printUsage(argv[0]); return 1;
+        }
+    }
+    if (options.threshold < 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (options.workers == 0) {
+        options.workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<Job> jobs;
+    if (optind == argc) {
+        for (const char *workload : defaultWorkloads) {
+            jobs.push_back({jobs.size(), workload});
+        }
+    } else {
+        for (int i = optind; i < argc; ++i) {
+            jobs.push_back({jobs.size(), argv[i]});
+        }
+    }
+
+    if (mkdir(options.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "ERROR: cannot create " << options.directory << std::endl;
+        return 1;
+    }
+    options.simulator = absolutePath(options.simulator);
+    options.workloadDirectory = absolutePath(options.workloadDirectory);
+    options.directory = absolutePath(options.directory);
+
+    // a worker takes the next workload in the list when it is done with one
+    unsigned workers = std::min<size_t>(options.workers, jobs.size());
+    std::atomic<size_t> next = {0};
+    std::vector<Result> results(jobs.size());
+    std::mutex printLock;
+
+    std::vector<std::thread> threads;
+    for (unsigned worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([&, worker]() {
+            size_t index;
+            while ((index = next.fetch_add(1)) < jobs.size()) {
+                const Job &job = jobs[index];
+                Result &result = results[index];
+                runJob(job, result);
+                std::lock_guard<std::mutex> guard(printLock);
+                std::cerr << "[" << worker << "] " << job.workload << ": " << result.status();
+                if (result.exited && !result.passed) {
+                    std::cerr << " (" << result.exitCode << ")";
+                }
+                if (!result.counters.empty()) {
+                    std::cerr << ", ipc " << rates(result).ipc;
+                }
+                std::cerr << " in " << std::fixed << std::setprecision(1) << result.seconds << "s" << std::defaultfloat << std::setprecision(6) << std::endl;
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    writeCsv(jobs, results);
+    size_t passed = 0;
+    for (const auto &result : results) {
+        passed += result.ok() ? 1 : 0;
+    }
+    std::cout << "passed " << passed << " of " << jobs.size() << std::endl;
+
+    bool regressed = false;
+    if (!options.baseline.empty()) {
+        regressed = compareBaseline(jobs, results);
+    }
+    return passed == jobs.size() && !regressed ? 0 : 1;
+}
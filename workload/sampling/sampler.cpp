@@ -0,0 +1,355 @@
+// Sampled simulation: runs one detailed window from each checkpoint of a list, several
+// simulators at a time, and estimates the CPI of the whole program from the windows.
+//
+// Each job starts its own simulator (the ubuntu.exe of a Connectal build), loads the
+// checkpoint with `l`, and runs `wd`: a warmup, then the window, whose counters the
+// simulator prints as "window <counter> <value>". The jobs are spread over the workers
+// at the start; a worker that runs out of jobs takes the last job of another one, so a
+// few long windows do not leave the other workers idle at the end.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cmath>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../Spawn.hpp"
+
+struct Job {
+    size_t index;
+    std::string checkpoint;
+    double weight;
+};
+
+struct Result {
+    bool ok = false;
+    bool complete = false;
+    double seconds = 0;
+    std::string error;
+    // in the order the simulator prints them
+    std::vector<std::pair<std::string, uint64_t>> counters;
+
+    uint64_t counter(const std::string &name) const {
+        for (const auto &c : counters) {
+            if (c.first == name) {
+                return c.second;
+            }
+        }
+        return 0;
+    }
+};
+
+struct Options {
+    unsigned workers = 0;
+    uint64_t warmup = 100000;
+    uint64_t window = 1000000;
+    unsigned timeout = 0;
+    int confidence = 95;
+    std::string simulator = "./bluesim/bin/ubuntu.exe";
+    std::string directory = ".";
+    std::string csv = "sampling.csv";
+    std::string list;
+};
+
+static Options options;
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options] <checkpoint-list>" << std::endl;
+    std::cerr << "Runs a detailed window from each checkpoint and estimates the CPI of the whole program" << std::endl;
+    std::cerr << "  checkpoint-list   one checkpoint per line: <snapshot.json> [weight], # starts a comment" << std::endl;
+    std::cerr << "                      the weight is the share of the program the checkpoint stands for (default 1)" << std::endl;
+    std::cerr << "  -j <workers>      simulators run at a time (default: the number of cores)" << std::endl;
+    std::cerr << "  -w <instructions> warmup before each window (default 100000)" << std::endl;
+    std::cerr << "  -n <instructions> length of each window (default 1000000)" << std::endl;
+    std::cerr << "  -s <command>      simulator command, run by /bin/sh (default ./bluesim/bin/ubuntu.exe)" << std::endl;
+    std::cerr << "  -d <directory>    working directory of the simulators, with the .vmh files (default .)" << std::endl;
+    std::cerr << "  -t <seconds>      kill a simulator that runs longer (default: no limit)" << std::endl;
+    std::cerr << "  -c <95|99>        confidence level of the interval (default 95)" << std::endl;
+    std::cerr << "  -o <file>         per-window results as CSV (default sampling.csv)" << std::endl;
+}
+
+static std::vector<Job> readList(const std::string &path) {
+    std::vector<Job> jobs;
+    std::ifstream list(path);
+    if (!list) {
+        std::cerr << "ERROR: cannot open " << path << std::endl;
+        exit(1);
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        Job job;
+        if (!(fields >> job.checkpoint)) {
+            continue;
+        }
+        if (!(fields >> job.weight)) {
+            job.weight = 1;
+        }
+        if (job.weight <= 0) {
+            std::cerr << "ERROR: " << job.checkpoint << ": the weight must be positive" << std::endl;
+            exit(1);
+        }
+        job.index = jobs.size();
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// A window line may follow a prompt printed without a newline, so the last "window "
+// of the line is taken.
+static bool parseWindowLine(const std::string &line, std::string &name, uint64_t &value) {
+    size_t start = line.rfind("window ");
+    if (start == std::string::npos) {
+        return false;
+    }
+    std::istringstream fields(line.substr(start + 7));
+    std::string rest;
+    return (fields >> name >> value) && !(fields >> rest);
+}
+
+static void runJob(const Job &job, Result &result) {
+    auto start = std::chrono::steady_clock::now();
+    SpawnRequest request;
+    request.argv = {"/bin/sh", "-c", options.simulator};
+    request.directory = options.directory;
+    // every simulator needs its own socket between the host and the simulation
+    request.environment = {"BLUESIM_SOCKET_NAME=sampler-" + std::to_string(getpid()) + "-" + std::to_string(job.index)};
+    std::ostringstream commands;
+    commands << "l\n" << job.checkpoint << "\n"
+             << "wd\n" << options.warmup << " " << options.window << "\n"
+             << "q\n";
+    request.input = commands.str();
+    request.timeout = options.timeout;
+
+    SpawnResult spawned = spawnWithTimeout(request, [&](const std::string &line) {
+        std::string name;
+        uint64_t value;
+        if (parseWindowLine(line, name, value)) {
+            if (name == "complete") {
+                result.complete = value != 0;
+            } else {
+                result.counters.emplace_back(name, value);
+            }
+        }
+    });
+
+    if (spawned.timedOut) {
+        result.error = "timed out";
+    } else if (!spawned.error.empty()) {
+        result.error = spawned.error;
+    } else if (spawned.status != 0) {
+        result.error = "simulator exited with status " + std::to_string(spawned.status);
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.ok = result.error.empty() && result.counter("instret") != 0;
+    if (result.error.empty() && !result.ok) {
+        result.error = "no window in the simulator output";
+    }
+}
+
+// One deque of jobs per worker. The owner takes from the front, the others steal from
+// the back.
+class JobQueues {
+    std::vector<std::deque<Job>> queues;
+    std::vector<std::mutex> locks;
+public:
+    JobQueues(const std::vector<Job> &jobs, unsigned workers) : queues(workers), locks(workers) {
+        for (const auto &job : jobs) {
+            queues[job.index % workers].push_back(job);
+        }
+    }
+
+    bool next(unsigned worker, Job &job, bool &stolen) {
+        for (unsigned i = 0; i < queues.size(); ++i) {
+            unsigned victim = (worker + i) % queues.size();
+            std::lock_guard<std::mutex> guard(locks[victim]);
+            if (queues[victim].empty()) {
+                continue;
+            }
+            if (i == 0) {
+                job = queues[victim].front();
+                queues[victim].pop_front();
+            } else {
+                job = queues[victim].back();
+                queues[victim].pop_back();
+            }
+            stolen = i != 0;
+            return true;
+        }
+        return false;
+    }
+};
+
+// two-sided critical values of Student's t for 1 to 30 degrees of freedom
+static const double t95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+static const double t99[] = {
+    63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169,
+    3.106, 3.055, 3.012, 2.977, 2.947, 2.921, 2.898, 2.878, 2.861, 2.845,
+    2.831, 2.819, 2.807, 2.797, 2.787, 2.779, 2.771, 2.763, 2.756, 2.750};
+
+static double criticalValue(int confidence, size_t degrees) {
+    if (degrees > 30) {
+        return confidence == 99 ? 2.576 : 1.960;
+    }
+    return confidence == 99 ? t99[degrees - 1] : t95[degrees - 1];
+}
+
+static void writeCsv(const std::vector<Job> &jobs, const std::vector<Result> &results) {
+    std::ofstream csv(options.csv);
+    if (!csv) {
+        std::cerr << "ERROR: cannot write " << options.csv << std::endl;
+        return;
+    }
+    // the counters of the first window that ran, the others print the same ones
+    std::vector<std::string> names;
+    for (const auto &result : results) {
+        if (result.ok) {
+            for (const auto &c : result.counters) {
+                names.push_back(c.first);
+            }
+            break;
+        }
+    }
+    csv << "checkpoint,weight,status,seconds,cpi";
+    for (const auto &name : names) {
+        csv << "," << name;
+    }
+    csv << std::endl;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const Result &result = results[i];
+        std::string status = !result.ok ? result.error : result.complete ? "ok" : "exited";
+        csv << jobs[i].checkpoint << "," << jobs[i].weight << "," << status << ","
+            << std::fixed << std::setprecision(1) << result.seconds << std::defaultfloat << std::setprecision(6) << ",";
+        if (result.ok) {
+            csv << (double)result.counter("cycles") / result.counter("instret");
+        }
+        for (const auto &name : names) {
+            csv << ",";
+            if (result.ok) {
+                csv << result.counter(name);
+            }
+        }
+        csv << std::endl;
+    }
+}
+
+// The weighted mean of the CPI of the windows, each weighted by the share of the program
+// its checkpoint stands for. The interval uses the effective number of windows,
+// (sum w)^2 / sum w^2, which is the number of windows when the weights are equal.
+static void printEstimate(const std::vector<Job> &jobs, const std::vector<Result> &results) {
+    double sumW = 0, sumW2 = 0, sumWX = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (!results[i].ok) {
+            continue;
+        }
+        double cpi = (double)results[i].counter("cycles") / results[i].counter("instret");
+        sumW += jobs[i].weight;
+        sumW2 += jobs[i].weight * jobs[i].weight;
+        sumWX += jobs[i].weight * cpi;
+        ++count;
+    }
+    std::cout << "windows " << count << " of " << jobs.size() << std::endl;
+    if (count == 0) {
+        return;
+    }
+    double mean = sumWX / sumW;
+    std::cout << "cpi " << mean << std::endl;
+    if (count == 1) {
+        std::cout << "no confidence interval with one window" << std::endl;
+        return;
+    }
+
+    double sumWD2 = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (results[i].ok) {
+            double cpi = (double)results[i].counter("cycles") / results[i].counter("instret");
+            sumWD2 += jobs[i].weight * (cpi - mean) * (cpi - mean);
+        }
+    }
+    double effective = sumW * sumW / sumW2;
+    double variance = sumWD2 / (sumW - sumW2 / sumW);
+    double halfWidth = criticalValue(options.confidence, std::max<size_t>(1, std::lround(effective) - 1))
+                     * std::sqrt(variance / effective);
+    std::cout << "ipc " << 1 / mean << std::endl;
+    std::cout << "cpi " << options.confidence << "% interval [" << mean - halfWidth << ", " << mean + halfWidth
+              << "] (+-" << 100 * halfWidth / mean << "%)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "j:w:n:s:d:t:c:o:h")) != -1) {
+        switch (opt) {
+            case 'j': options.workers = strtoul(optarg, nullptr, 0); break;
+            case 'w': options.warmup = strtoull(optarg, nullptr, 0); break;
+            case 'n': options.window = strtoull(optarg, nullptr, 0); break;
+            case 's': options.simulator = optarg; break;
+            case 'd': options.directory = optarg; break;
+            case 't': options.timeout = strtoul(optarg, nullptr, 0); break;
+            case 'c': options.confidence = atoi(optarg); break;
+            case 'o': options.csv = optarg; break;
+            default: printUsage(argv[0]); return 1;
+        }
+    }
+    if (optind + 1 != argc || options.window == 0 || (options.confidence != 95 && options.confidence != 99)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    options.list = argv[optind];
+    if (options.workers == 0) {
+        options.workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<Job> jobs = readList(options.list);
+    if (jobs.empty()) {
+        std::cerr << "ERROR: no checkpoint in " << options.list << std::endl;
+        return 1;
+    }
+    unsigned workers = std::min<size_t>(options.workers, jobs.size());
+    JobQueues queues(jobs, workers);
+    std::vector<Result> results(jobs.size());
+    std::mutex printLock;
+
+    std::vector<std::thread> threads;
+    for (unsigned worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([&, worker]() {
+            Job job;
+            bool stolen;
+            while (queues.next(worker, job, stolen)) {
+                Result &result = results[job.index];
+                runJob(job, result);
+                std::lock_guard<std::mutex> guard(printLock);
+                std::cerr << "[" << worker << (stolen ? ", stolen" : "") << "] " << job.checkpoint << ": ";
+                if (result.ok) {
+                    std::cerr << "cpi " << (double)result.counter("cycles") / result.counter("instret")
+                              << (result.complete ? "" : " (program exited in the window)");
+                } else {
+                    std::cerr << result.error;
+                }
+                std::cerr << " in " << std::fixed << std::setprecision(1) << result.seconds << "s" << std::defaultfloat << std::setprecision(6) << std::endl;
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    writeCsv(jobs, results);
+    printEstimate(jobs, results);
+    return 0;
+}
@@ -0,0 +1,366 @@
+// Picks simulation points from the basic-block vectors written by the `bb` command.
+//
+// As SimPoint does: the vectors are normalized, projected to a few random dimensions,
+// and clustered with k-means for every k up to a maximum; the smallest k whose BIC
+// score reaches a fraction of the best one is kept. Each cluster is represented by the
+// interval closest to its centre, with the share of the instructions of the program in
+// the cluster as its weight.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+typedef std::vector<double> Point;
+
+struct Clustering {
+    std::vector<Point> centres;
+    std::vector<int> assignment;
+    double distortion = 0;
+    double bic = 0;
+};
+
+struct Options {
+    int maxK = 10;
+    int dimensions = 15;
+    int restarts = 5;
+    int iterations = 100;
+    double bicThreshold = 0.9;
+    unsigned seed = 1;
+    uint64_t interval = 0;
+    uint64_t warmup = 0;
+    std::string prefix;
+    std::string script;
+    std::string list;
+    std::string checkpoint = "simpoint_%d.json";
+};
+
+static Options options;
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options] <bbv-file>" << std::endl;
+    std::cerr << "Clusters the intervals of a basic-block vector file and picks one interval per cluster" << std::endl;
+    std::cerr << "  bbv-file          written by the bb command of the host, its .len file is used if it exists" << std::endl;
+    std::cerr << "  -k <clusters>     largest number of clusters tried (default 10)" << std::endl;
+    std::cerr << "  -d <dimensions>   dimensions of the random projection (default 15)" << std::endl;
+    std::cerr << "  -r <restarts>     k-means runs per number of clusters, the best one is kept (default 5)" << std::endl;
+    std::cerr << "  -b <fraction>     keep the smallest k whose BIC reaches this fraction of the range (default 0.9)" << std::endl;
+    std::cerr << "  -s <seed>         seed of the projection and of the initial centres (default 1)" << std::endl;
+    std::cerr << "  -n <instructions> interval length, when there is no .len file" << std::endl;
+    std::cerr << "  -o <prefix>       write <prefix>.simpoints and <prefix>.weights in the SimPoint format" << std::endl;
+    std::cerr << "  -g <script>       write host commands that save a checkpoint before each simulation point" << std::endl;
+    std::cerr << "  -w <instructions> checkpoints this many instructions before the points, for the warmup (default 0)" << std::endl;
+    std::cerr << "  -c <pattern>      checkpoint path, %d is the interval (default simpoint_%d.json)" << std::endl;
+    std::cerr << "  -l <list>         write the checkpoint list of the sampler, with the weights" << std::endl;
+}
+
+// T:<bucket>:<count> :<bucket>:<count> ... with the buckets numbered from 1
+static std::vector<std::vector<std::pair<int, double>>> readVectors(const std::string &path, int &buckets) {
+    std::vector<std::vector<std::pair<int, double>>> vectors;
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "ERROR: cannot open " << path << std::endl;
+        exit(1);
+    }
+    buckets = 0;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] != 'T') {
+            continue;
+        }
+        std::vector<std::pair<int, double>> vector;
+        std::istringstream fields(line.substr(1));
+        std::string field;
+        while (fields >> field) {
+            int bucket;
+            double count;
+            if (sscanf(field.c_str(), ":%d:%lf", &bucket, &count) != 2 || bucket < 1) {
+                std::cerr << "ERROR: " << path << ": bad entry " << field << std::endl;
+                exit(1);
+            }
+            vector.emplace_back(bucket - 1, count);
+            buckets = std::max(buckets, bucket);
+        }
+        vectors.push_back(vector);
+    }
+    return vectors;
+}
+
+// without a .len file that matches, every interval is -n instructions long
+static std::vector<uint64_t> readLengths(const std::string &path, size_t count) {
+    std::vector<uint64_t> lengths;
+    std::ifstream file(path);
+    uint64_t length;
+    while (file >> length) {
+        lengths.push_back(length);
+    }
+    if (lengths.size() == count) {
+        return lengths;
+    }
+    if (options.interval == 0) {
+        std::cerr << "ERROR: no interval lengths in " << path << ", give them with -n" << std::endl;
+        exit(1);
+    }
+    return std::vector<uint64_t>(count, options.interval);
+}
+
+// normalized to a sum of 1, then multiplied by a random matrix with entries in [-1, 1]
+static std::vector<Point> project(const std::vector<std::vector<std::pair<int, double>>> &vectors, int buckets) {
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<double> entry(-1, 1);
+    std::vector<Point> matrix(buckets, Point(options.dimensions));
+    for (auto &row : matrix) {
+        for (auto &value : row) {
+            value = entry(random);
+        }
+    }
+
+    std::vector<Point> points;
+    for (const auto &vector : vectors) {
+        double total = 0;
+        for (const auto &entry : vector) {
+            total += entry.second;
+        }
+        Point point(options.dimensions, 0);
+        for (const auto &entry : vector) {
+            for (int d = 0; d < options.dimensions; ++d) {
+                point[d] += entry.second / total * matrix[entry.first][d];
+            }
+        }
+        points.push_back(point);
+    }
+    return points;
+}
+
+static double distance2(const Point &a, const Point &b) {
+    double sum = 0;
+    for (size_t d = 0; d < a.size(); ++d) {
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    }
+    return sum;
+}
+
+// k-means++ initial centres, then Lloyd iterations until no point moves
+static Clustering kmeans(const std::vector<Point> &points, int k, std::mt19937 &random) {
+    Clustering c;
+    std::vector<double> nearest(points.size(), std::numeric_limits<double>::max());
+    c.centres.push_back(points[std::uniform_int_distribution<size_t>(0, points.size() - 1)(random)]);
+    while ((int)c.centres.size() < k) {
+        for (size_t i = 0; i < points.size(); ++i) {
+            nearest[i] = std::min(nearest[i], distance2(points[i], c.centres.back()));
+        }
+        // fewer distinct points than clusters: any point, its cluster stays empty
+        if (std::all_of(nearest.begin(), nearest.end(), [](double d) { return d == 0; })) {
+            c.centres.push_back(points[std::uniform_int_distribution<size_t>(0, points.size() - 1)(random)]);
+            continue;
+        }
+        std::discrete_distribution<size_t> pick(nearest.begin(), nearest.end());
+        c.centres.push_back(points[pick(random)]);
+    }
+
+    c.assignment.assign(points.size(), -1);
+    for (int iteration = 0; iteration < options.iterations; ++iteration) {
+        bool moved = false;
+        for (size_t i = 0; i < points.size(); ++i) {
+            int best = 0;
+            for (int j = 1; j < k; ++j) {
+                if (distance2(points[i], c.centres[j]) < distance2(points[i], c.centres[best])) {
+                    best = j;
+                }
+            }
+            moved |= c.assignment[i] != best;
+            c.assignment[i] = best;
+        }
+        if (!moved) {
+            break;
+        }
+        std::vector<Point> sums(k, Point(points[0].size(), 0));
+        std::vector<size_t> sizes(k, 0);
+        for (size_t i = 0; i < points.size(); ++i) {
+            for (size_t d = 0; d < points[i].size(); ++d) {
+                sums[c.assignment[i]][d] += points[i][d];
+            }
+            ++sizes[c.assignment[i]];
+        }
+        // an empty cluster keeps its centre
+        for (int j = 0; j < k; ++j) {
+            if (sizes[j] != 0) {
+                for (auto &value : sums[j]) {
+                    value /= sizes[j];
+                }
+                c.centres[j] = sums[j];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < points.size(); ++i) {
+        c.distortion += distance2(points[i], c.centres[c.assignment[i]]);
+    }
+    return c;
+}
+
+// BIC of a mixture of spherical Gaussians with one variance (Pelleg and Moore, X-means)
+static double bic(const std::vector<Point> &points, const Clustering &c) {
+    double n = points.size();
+    double d = points[0].size();
+    double k = c.centres.size();
+    double variance = n > k ? c.distortion / (d * (n - k)) : 0;
+    variance = std::max(variance, 1e-12);
+    std::vector<double> sizes(c.centres.size(), 0);
+    for (int j : c.assignment) {
+        sizes[j] += 1;
+    }
+    double likelihood = 0;
+    for (double size : sizes) {
+        if (size != 0) {
+            likelihood += size * std::log(size / n) - size * d / 2 * std::log(2 * M_PI * variance) - (size - 1) * d / 2;
+        }
+    }
+    double parameters = (k - 1) + k * d + 1;
+    return likelihood - parameters / 2 * std::log(n);
+}
+
+static std::string checkpointPath(size_t interval) {
+    char path[4096];
+    snprintf(path, sizeof(path), options.checkpoint.c_str(), (int)interval);
+    return path;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "k:d:r:b:s:n:o:g:w:c:l:h")) != -1) {
+        switch (opt) {
+            case 'k': options.maxK = atoi(optarg); break;
+            case 'd': options.dimensions = atoi(optarg); break;
+            case 'r': options.restarts = atoi(optarg); break;
+            case 'b': options.bicThreshold = atof(optarg); break;
+            case 's': options.seed = strtoul(optarg, nullptr, 0); break;
+            case 'n': options.interval = strtoull(optarg, nullptr, 0); break;
+            case 'o': options.prefix = optarg; break;
+            case 'g': options.script = optarg; break;
+            case 'w': options.warmup = strtoull(optarg, nullptr, 0); break;
+            case 'c': options.checkpoint = optarg; break;
+            case 'l': options.list = optarg; break;
+            default: printUsage(argv[0]); return 1;
+        }
+    }
+    if (optind + 1 != argc || options.maxK < 1 || options.dimensions < 1 || options.restarts < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::string path = argv[optind];
+
+    int buckets;
+    auto vectors = readVectors(path, buckets);
+    // an interval without any taken branch is one straight-line block
+    for (auto &vector : vectors) {
+        if (vector.empty()) {
+            vector.emplace_back(0, 1);
+        }
+    }
+    if (vectors.empty()) {
+        std::cerr << "ERROR: no interval in " << path << std::endl;
+        return 1;
+    }
+    auto lengths = readLengths(path + ".len", vectors.size());
+    auto points = project(vectors, std::max(buckets, 1));
+
+    std::mt19937 random(options.seed);
+    std::vector<Clustering> results;
+    int maxK = std::min<int>(options.maxK, points.size());
+    for (int k = 1; k <= maxK; ++k) {
+        Clustering best;
+        for (int run = 0; run < options.restarts; ++run) {
+            Clustering c = kmeans(points, k, random);
+            if (run == 0 || c.distortion < best.distortion) {
+                best = c;
+            }
+        }
+        best.bic = bic(points, best);
+        results.push_back(best);
+    }
+    double low = results[0].bic, high = results[0].bic;
+    for (const auto &c : results) {
+        low = std::min(low, c.bic);
+        high = std::max(high, c.bic);
+    }
+    size_t chosen = 0;
+    while (chosen + 1 < results.size() && high > low && (results[chosen].bic - low) / (high - low) < options.bicThreshold) {
+        ++chosen;
+    }
+    const Clustering &c = results[chosen];
+
+    // the representative of a cluster is the interval closest to its centre
+    int k = c.centres.size();
+    std::vector<long> representative(k, -1);
+    std::vector<double> weight(k, 0);
+    double total = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+        int j = c.assignment[i];
+        if (representative[j] < 0 || distance2(points[i], c.centres[j]) < distance2(points[representative[j]], c.centres[j])) {
+            representative[j] = i;
+        }
+        weight[j] += lengths[i];
+        total += lengths[i];
+    }
+    std::vector<uint64_t> start(points.size(), 0);
+    for (size_t i = 1; i < points.size(); ++i) {
+        start[i] = start[i - 1] + lengths[i - 1];
+    }
+
+    std::vector<int> order;
+    for (int j = 0; j < k; ++j) {
+        if (representative[j] >= 0) {
+            order.push_back(j);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return representative[a] < representative[b]; });
+
+    std::cout << points.size() << " intervals, " << order.size() << " clusters (BIC "
+              << std::setprecision(6) << c.bic << ")" << std::endl;
+    std::cout << "cluster interval start weight" << std::endl;
+    for (int j : order) {
+        std::cout << j << " " << representative[j] << " " << start[representative[j]] << " " << weight[j] / total << std::endl;
+    }
+
+    if (!options.prefix.empty()) {
+        std::ofstream simpoints(options.prefix + ".simpoints");
+        std::ofstream weights(options.prefix + ".weights");
+        for (int j : order) {
+            simpoints << representative[j] << " " << j << std::endl;
+            weights << weight[j] / total << " " << j << std::endl;
+        }
+    }
+    // from reset: ri up to warmup instructions before each point, then s
+    if (!options.script.empty()) {
+        std::ofstream script(options.script);
+        uint64_t position = 0;
+        for (int j : order) {
+            uint64_t target = start[representative[j]];
+            target = target > options.warmup ? target - options.warmup : 0;
+            if (target > position) {
+                script << "ri\n" << target - position << "\n";
+                position = target;
+            }
+            script << "s\n" << checkpointPath(representative[j]) << "\n";
+        }
+        script << "q\n";
+    }
+    if (!options.list.empty()) {
+        std::ofstream list(options.list);
+        for (int j : order) {
+            list << checkpointPath(representative[j]) << " " << weight[j] / total << std::endl;
+        }
+    }
+    return 0;
+}
@@ -3,6 +3,8 @@ int* PUT_ADDR = (int *)0xF000fff0;
 int* GET_ADDR = (int *)0xF000fff4;
 int* FINISH_ADDR = (int *)0xF000fff8;
 int* WAIT_ADDR = (int *)0xF000fffC;
+int* HART_ADDR = (int *)0xF000ffeC;
+volatile unsigned int* CYCLE_ADDR = (unsigned int *)0xF000ffe8;
 
 int getchar() {
   return *GET_ADDR;
@@ -18,6 +20,40 @@ int exit(int c) {
   return c;
 }
 
+int hart_id() {
+  return *HART_ADDR;
+}
+
+__attribute__((weak)) void hart_main(int hart) {
+}
+
+unsigned int cycles() {
+  return *CYCLE_ADDR;
+}
+
+void print_str(const char *s) {
+  while (*s) {
+    putchar(*s++);
+  }
+}
+
+// digits by repeated subtraction of the powers of ten
+void print_uint(unsigned int n) {
+  static const unsigned int powers[] = {1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1};
+  int started = 0;
+  for (int i = 0; i < 10; i++) {
+    int digit = 0;
+    while (n >= powers[i]) {
+      n -= powers[i];
+      digit++;
+    }
+    if (digit != 0 || started || i == 9) {
+      putchar('0' + digit);
+      started = 1;
+    }
+  }
+}
+
 void waitForSnapshot(){ 
   // Set the value of the x10 to 0. 
   __asm__ volatile(
@@ -7,4 +7,15 @@ int exit(int c);
 
 void waitForSnapshot();
 
+// index of the core running the code (0 in a single-core build)
+int hart_id();
+// run by every core but core 0, which runs main; does nothing unless the test defines it
+void hart_main(int hart);
+
+// low 32 bits of the cycle counter of the core running the code (the cycles of `p`)
+unsigned int cycles();
+// through putchar, in decimal; rv32i has no division, so no printf
+void print_str(const char *s);
+void print_uint(unsigned int n);
+
 #endif
@@ -0,0 +1,69 @@
+// Random access, as GUPS: read-modify-write updates of random words of a table of 1KB
+// up to GUPS_MAX_BYTES, with no locality beyond the table size. After GUPS_UPDATES
+// updates that warm the caches, the same number is timed:
+//   gups table <bytes> updates <updates> cycles <cycles>
+// Every update xors a random value into the table; the same updates again must give the
+// table back, exit(1) otherwise.
+#include "../mmio.h"
+
+#ifndef GUPS_MAX_BYTES
+#define GUPS_MAX_BYTES 65536
+#endif
+#ifndef GUPS_UPDATES
+#define GUPS_UPDATES 4096
+#endif
+
+unsigned int table[GUPS_MAX_BYTES / 4];
+
+static unsigned int xorshift(unsigned int x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// returns the state of the random numbers for the next call
+static unsigned int update(unsigned int mask, unsigned int random) {
+    for (int i = 0; i < GUPS_UPDATES; i++) {
+        random = xorshift(random);
+        table[(random >> 7) & mask] ^= random;
+    }
+    return random;
+}
+
+static void report(unsigned int bytes, unsigned int elapsed) {
+    print_str("gups table ");
+    print_uint(bytes);
+    print_str(" updates ");
+    print_uint(GUPS_UPDATES);
+    print_str(" cycles ");
+    print_uint(elapsed);
+    putchar('\n');
+}
+
+int main() {
+    for (unsigned int bytes = 1024; bytes <= GUPS_MAX_BYTES; bytes <<= 1) {
+        unsigned int mask = (bytes >> 2) - 1;
+        for (unsigned int i = 0; i <= mask; i++) {
+            table[i] = i;
+        }
+
+        unsigned int seed = 0x9E3779B9;
+        unsigned int random = update(mask, seed);
+        unsigned int start = cycles();
+        update(mask, random);
+        unsigned int elapsed = cycles() - start;
+        report(bytes, elapsed);
+
+        update(mask, update(mask, seed));
+        for (unsigned int i = 0; i <= mask; i++) {
+            if (table[i] != i) {
+                print_str("gups wrong value at ");
+                print_uint(i);
+                putchar('\n');
+                exit(1);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+// I-cache footprint sweep: calls to the first <blocks> of 512 blocks of straight-line
+// code, 64 bytes (one line) each, so that the code of the loop grows from 1KB to 32KB
+// across the L1i (8KB) and the L2 (16KB). After a pass that warms the caches,
+// ICACHE_CALLS calls are timed:
+//   icache footprint <bytes> calls <calls> cycles <cycles>
+// Every block adds 1 to its argument, so the result must be the number of calls,
+// exit(1) otherwise.
+#include "../mmio.h"
+
+#ifndef ICACHE_CALLS
+#define ICACHE_CALLS 4096
+#endif
+
+#define ICACHE_BLOCKS 512
+
+// 14 nops, the add and the return in 16 4-byte instructions: no compressed encodings,
+// so that a block is a line in the rv32ic build too
+__asm__(
+    ".pushsection .text\n"
+    ".balign 64\n"
+    ".globl icache_blocks\n"
+    "icache_blocks:\n"
+    ".option push\n"
+    ".option norvc\n"
+    ".rept 512\n"
+    ".rept 14\n"
+    "nop\n"
+    ".endr\n"
+    "addi a0, a0, 1\n"
+    "ret\n"
+    ".endr\n"
+    ".option pop\n"
+    ".popsection\n");
+
+extern char icache_blocks[];
+
+typedef unsigned int (*block)(unsigned int);
+
+static unsigned int run(unsigned int blocks, unsigned int passes) {
+    unsigned int count = 0;
+    for (unsigned int p = 0; p < passes; p++) {
+        for (unsigned int b = 0; b < blocks; b++) {
+            count = ((block)(icache_blocks + (b << 6)))(count);
+        }
+    }
+    return count;
+}
+
+static void report(unsigned int footprint, unsigned int elapsed) {
+    print_str("icache footprint ");
+    print_uint(footprint);
+    print_str(" calls ");
+    print_uint(ICACHE_CALLS);
+    print_str(" cycles ");
+    print_uint(elapsed);
+    putchar('\n');
+}
+
+int main() {
+    for (unsigned int log2Blocks = 4; (1u << log2Blocks) <= ICACHE_BLOCKS; log2Blocks++) {
+        unsigned int blocks = 1 << log2Blocks;
+        unsigned int warm = run(blocks, 1);
+
+        unsigned int start = cycles();
+        unsigned int count = run(blocks, ICACHE_CALLS >> log2Blocks);
+        unsigned int elapsed = cycles() - start;
+        report(blocks << 6, elapsed);
+        if (warm != blocks || count != ICACHE_CALLS) {
+            print_str("icache wrong count\n");
+            exit(1);
+        }
+    }
+    return 0;
+}
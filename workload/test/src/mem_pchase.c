@@ -0,0 +1,148 @@
+// Pointer chasing: the load latency of each level, and how much of it independent
+// chains overlap. The footprint, 1KB up to PCHASE_MAX_BYTES, holds one node per 64-byte
+// line, linked in a random order into 1, 2 or 4 chains of equal length. A walk through
+// every chain checks it and warms the caches, then PCHASE_LOADS loads spread over the
+// chains are timed:
+//   pchase chains <n> footprint <bytes> loads <loads> cycles <cycles>
+// A chain that does not come back to its head after its length exits with 1.
+#include "../mmio.h"
+
+#ifndef PCHASE_MAX_BYTES
+#define PCHASE_MAX_BYTES 65536
+#endif
+#ifndef PCHASE_LOADS
+#define PCHASE_LOADS 4096
+#endif
+
+#define PCHASE_MAX_NODES (PCHASE_MAX_BYTES / 64)
+
+typedef struct node {
+    struct node *next;
+    int pad[15];
+} node;
+
+node nodes[PCHASE_MAX_NODES];
+unsigned int order[PCHASE_MAX_NODES];
+
+static unsigned int seed = 0x2545F491;
+
+static unsigned int xorshift() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// Fisher-Yates, the index drawn below the next power of two until it fits: rv32i has
+// no division for a modulo
+static void shuffle(unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (unsigned int i = n - 1; i > 0; i--) {
+        unsigned int mask = i;
+        mask |= mask >> 1;
+        mask |= mask >> 2;
+        mask |= mask >> 4;
+        mask |= mask >> 8;
+        mask |= mask >> 16;
+        unsigned int j;
+        do {
+            j = xorshift() & mask;
+        } while (j > i);
+        unsigned int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+// chain k takes the nodes at positions k, k + chains, k + 2 * chains ... of the order
+static void link(unsigned int n, unsigned int chains) {
+    for (unsigned int k = 0; k < chains; k++) {
+        unsigned int i = k;
+        while (i + chains < n) {
+            nodes[order[i]].next = &nodes[order[i + chains]];
+            i += chains;
+        }
+        nodes[order[i]].next = &nodes[order[k]];
+    }
+}
+
+// where the timed walks stop, so that the loads are kept
+node *ends[4];
+
+// the chains advance in turn, each load depends only on the previous one of its chain
+static node *chase1(node *p, unsigned int rounds) {
+    for (unsigned int r = 0; r < rounds; r++) {
+        p = p->next;
+    }
+    return p;
+}
+
+static void chase2(node *p, node *q, unsigned int rounds) {
+    for (unsigned int r = 0; r < rounds; r++) {
+        p = p->next;
+        q = q->next;
+    }
+    ends[0] = p;
+    ends[1] = q;
+}
+
+static void chase4(node *p, node *q, node *s, node *t, unsigned int rounds) {
+    for (unsigned int r = 0; r < rounds; r++) {
+        p = p->next;
+        q = q->next;
+        s = s->next;
+        t = t->next;
+    }
+    ends[0] = p;
+    ends[1] = q;
+    ends[2] = s;
+    ends[3] = t;
+}
+
+// rounds steps of every chain, from their heads
+static void chase(unsigned int chains, unsigned int rounds) {
+    switch (chains) {
+        case 1: ends[0] = chase1(&nodes[order[0]], rounds); break;
+        case 2: chase2(&nodes[order[0]], &nodes[order[1]], rounds); break;
+        default: chase4(&nodes[order[0]], &nodes[order[1]], &nodes[order[2]], &nodes[order[3]], rounds); break;
+    }
+}
+
+static void report(unsigned int chains, unsigned int footprint, unsigned int elapsed) {
+    print_str("pchase chains ");
+    print_uint(chains);
+    print_str(" footprint ");
+    print_uint(footprint);
+    print_str(" loads ");
+    print_uint(PCHASE_LOADS);
+    print_str(" cycles ");
+    print_uint(elapsed);
+    putchar('\n');
+}
+
+int main() {
+    for (unsigned int footprint = 1024; footprint <= PCHASE_MAX_BYTES; footprint <<= 1) {
+        unsigned int n = footprint >> 6;
+        shuffle(n);
+        for (unsigned int log2Chains = 0; log2Chains <= 2; log2Chains++) {
+            unsigned int chains = 1 << log2Chains;
+            unsigned int length = n >> log2Chains;
+            link(n, chains);
+
+            for (unsigned int k = 0; k < chains; k++) {
+                if (chase1(&nodes[order[k]], length) != &nodes[order[k]]) {
+                    print_str("pchase broken chain\n");
+                    exit(1);
+                }
+            }
+
+            unsigned int start = cycles();
+            chase(chains, PCHASE_LOADS >> log2Chains);
+            unsigned int elapsed = cycles() - start;
+            report(chains, footprint, elapsed);
+        }
+    }
+    return 0;
+}
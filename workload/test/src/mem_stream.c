@@ -0,0 +1,94 @@
+// STREAM copy, scale and triad over three arrays of 1KB up to STREAM_MAX_BYTES each,
+// across the L1d (8KB), the L2 (16KB) and main memory. For each array size and kernel,
+// one pass warms the caches and STREAM_REPEAT timed passes follow:
+//   stream <kernel> array <bytes> moved <bytes read and written> cycles <cycles>
+// The arrays are checked at the end, exit(1) on a wrong value.
+#include "../mmio.h"
+
+// the loops must stay loops: there is no memcpy or memset without a C library
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
+
+#ifndef STREAM_MAX_BYTES
+#define STREAM_MAX_BYTES 32768
+#endif
+#ifndef STREAM_REPEAT
+#define STREAM_REPEAT 2
+#endif
+
+#define STREAM_MAX_WORDS (STREAM_MAX_BYTES / 4)
+
+int a[STREAM_MAX_WORDS];
+int b[STREAM_MAX_WORDS];
+int c[STREAM_MAX_WORDS];
+
+// scale factor 3, as shifts and adds: rv32i has no multiplication
+static void copy(int n) {
+    for (int i = 0; i < n; i++) {
+        c[i] = a[i];
+    }
+}
+
+static void scale(int n) {
+    for (int i = 0; i < n; i++) {
+        b[i] = (c[i] << 1) + c[i];
+    }
+}
+
+static void triad(int n) {
+    for (int i = 0; i < n; i++) {
+        a[i] = b[i] + (c[i] << 1) + c[i];
+    }
+}
+
+static void report(const char *kernel, unsigned int array, unsigned int moved, unsigned int elapsed) {
+    print_str("stream ");
+    print_str(kernel);
+    print_str(" array ");
+    print_uint(array);
+    print_str(" moved ");
+    print_uint(moved);
+    print_str(" cycles ");
+    print_uint(elapsed);
+    putchar('\n');
+}
+
+// passBytes: read and written by one pass
+static void measure(const char *kernel, void (*run)(int), int n, unsigned int passBytes) {
+    run(n);
+    unsigned int moved = 0;
+    unsigned int start = cycles();
+    for (int r = 0; r < STREAM_REPEAT; r++) {
+        run(n);
+        moved += passBytes;
+    }
+    unsigned int elapsed = cycles() - start;
+    report(kernel, n << 2, moved, elapsed);
+}
+
+int main() {
+    int n = 0;
+    for (unsigned int bytes = 1024; bytes <= STREAM_MAX_BYTES; bytes <<= 1) {
+        n = bytes >> 2;
+        for (int i = 0; i < n; i++) {
+            a[i] = i;
+            b[i] = 0;
+            c[i] = 0;
+        }
+        // each kernel gives the same result every pass: c = a, b = 3c, a = b + 3c
+        measure("copy", copy, n, n << 3);
+        measure("scale", scale, n, n << 3);
+        measure("triad", triad, n, (n << 3) + (n << 2));
+    }
+
+    int expected = 0;
+    for (int i = 0; i < n; i++) {
+        if (c[i] != i || b[i] != (i << 1) + i || a[i] != expected) {
+            print_str("stream wrong value at ");
+            print_uint(i);
+            putchar('\n');
+            exit(1);
+        }
+        expected += 6;
+    }
+    return 0;
+}
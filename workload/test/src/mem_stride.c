@@ -0,0 +1,68 @@
+// Strided walks: loads every <stride> bytes of a footprint of 2KB up to STRIDE_MAX_BYTES,
+// wrapping at its end, for strides of 4 to 256 bytes. The footprints cross the L1d
+// (8KB) and the L2 (16KB, 2 banks by line address); from 64 bytes on every load is
+// in a new line, and the large strides use fewer sets and banks. After a pass that
+// warms the caches, STRIDE_LOADS loads are timed:
+//   stride bytes <stride> footprint <bytes> loads <loads> cycles <cycles>
+// Every word holds 1, so the sum of the loads must be their number, exit(1) otherwise.
+#include "../mmio.h"
+
+#ifndef STRIDE_MAX_BYTES
+#define STRIDE_MAX_BYTES 65536
+#endif
+#ifndef STRIDE_LOADS
+#define STRIDE_LOADS 4096
+#endif
+
+int buffer[STRIDE_MAX_BYTES / 4];
+// the sum of the warming pass, kept so that the pass is not optimized away
+unsigned int warmed;
+
+// step and mask in words
+static unsigned int walk(unsigned int step, unsigned int mask, unsigned int loads) {
+    unsigned int sum = 0;
+    unsigned int i = 0;
+    for (unsigned int k = 0; k < loads; k++) {
+        sum += buffer[i];
+        i = (i + step) & mask;
+    }
+    return sum;
+}
+
+static void report(unsigned int stride, unsigned int footprint, unsigned int elapsed) {
+    print_str("stride bytes ");
+    print_uint(stride);
+    print_str(" footprint ");
+    print_uint(footprint);
+    print_str(" loads ");
+    print_uint(STRIDE_LOADS);
+    print_str(" cycles ");
+    print_uint(elapsed);
+    putchar('\n');
+}
+
+int main() {
+    for (unsigned int i = 0; i < STRIDE_MAX_BYTES / 4; i++) {
+        buffer[i] = 1;
+    }
+
+    for (unsigned int footprint = 2048; footprint <= STRIDE_MAX_BYTES; footprint <<= 1) {
+        unsigned int mask = (footprint >> 2) - 1;
+        for (unsigned int log2Stride = 2; log2Stride <= 8; log2Stride++) {
+            unsigned int stride = 1 << log2Stride;
+            unsigned int step = stride >> 2;
+            // one pass touches every line the walk uses
+            warmed += walk(step, mask, (footprint >> log2Stride) + 1);
+
+            unsigned int start = cycles();
+            unsigned int sum = walk(step, mask, STRIDE_LOADS);
+            unsigned int elapsed = cycles() - start;
+            report(stride, footprint, elapsed);
+            if (sum != STRIDE_LOADS) {
+                print_str("stride wrong sum\n");
+                exit(1);
+            }
+        }
+    }
+    return 0;
+}